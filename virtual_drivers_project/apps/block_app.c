@@ -12,7 +12,7 @@
 #include <errno.h>
 #include <math.h>
 
-#define DEVICE_PATH "/dev/simple_block"
+#define DEVICE_PATH "/dev/simple_block0"
 #define SECTOR_SIZE 512
 #define MAX_SECTORS 65536
 #define MAX_BUFFER_SIZE (SECTOR_SIZE * 64)  // 32KB
@@ -718,6 +718,23 @@ void fill_pattern(int fd) {
     printf("\n" COLOR_CYAN "Filling sectors %lu to %lu...\n" COLOR_RESET,
            start_sector, start_sector + num_sectors - 1);
     
+    // Zero fill is a single BLKZEROOUT request; the driver releases the
+    // range instead of writing it sector by sector
+    if (pattern_type == 1) {
+        unsigned long long range[2] = { (unsigned long long)start_sector * SECTOR_SIZE, total_bytes };
+        double zero_start = get_time_ms();
+        
+        if (ioctl(fd, BLKZEROOUT, range) == 0) {
+            printf(COLOR_GREEN "Fill completed successfully!\n" COLOR_RESET);
+            printf("Sectors zeroed:  %lu (single BLKZEROOUT)\n", num_sectors);
+            printf("Total time:      %.2f ms\n", get_time_ms() - zero_start);
+            free(buffer);
+            return;
+        }
+        printf(COLOR_YELLOW "BLKZEROOUT failed (%s), writing zeros instead\n" COLOR_RESET,
+               strerror(errno));
+    }
+    
     double start_time = get_time_ms();
     unsigned long sectors_written = 0;
     
@@ -1151,8 +1168,8 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, COLOR_RED "Failed to open device: %s\n" COLOR_RESET, strerror(errno));
         fprintf(stderr, "Make sure the driver is loaded:\n");
         fprintf(stderr, "  sudo insmod simple_block.ko\n");
-        fprintf(stderr, "  sudo mknod /dev/simple_block b 241 0\n");
-        fprintf(stderr, "  sudo chmod 666 /dev/simple_block\n");
+        fprintf(stderr, "  sudo mknod /dev/simple_block0 b 241 0\n");
+        fprintf(stderr, "  sudo chmod 666 /dev/simple_block0\n");
         return EXIT_FAILURE;
     }
     
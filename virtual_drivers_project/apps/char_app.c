@@ -4,13 +4,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include <ctype.h>
 #include <termios.h>
 #include <errno.h>
+#include <stdint.h>
 
-#define DEVICE_PATH "/dev/simple_char"
+#define DEVICE_PATH "/dev/simple_char0"
 #define MAX_BUFFER_SIZE 65536
 #define MAX_THREADS 10
 #define IOCTL_MAGIC 'C'
@@ -28,6 +30,19 @@ struct char_stats {
     int buffer_size;
 };
 
+#define CHAR_GET_STATS_EXT _IOR(IOCTL_MAGIC, 9, struct char_stats_ext)
+
+struct char_stats_ext {
+    uint32_t version;
+    uint32_t size;
+    uint64_t read_ops;
+    uint64_t write_ops;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t buffer_used;
+    uint64_t buffer_size;
+};
+
 typedef struct {
     int fd;
     char *data;
@@ -72,6 +87,7 @@ void compare_with_file(int fd);
 void buffer_operations(int fd);
 void* thread_function(void* arg);
 double get_time_ms();
+char* map_device(int fd, size_t *size);
 
 // Utility functions
 void enable_raw_mode() {
@@ -118,6 +134,26 @@ double get_time_ms() {
     return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
+// Map the used part of the device buffer read-only. Returns NULL when the
+// buffer is empty or the driver does not support mmap; callers then fall
+// back to read().
+char* map_device(int fd, size_t *size) {
+    struct char_stats stats;
+    void *map;
+    
+    if (ioctl(fd, CHAR_GET_STATS, &stats) < 0 || stats.buffer_used <= 0) {
+        return NULL;
+    }
+    
+    map = mmap(NULL, stats.buffer_used, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    *size = stats.buffer_used;
+    return map;
+}
+
 void* thread_function(void* arg) {
     thread_args* args = (thread_args*)arg;
     char buffer[1024];
@@ -433,14 +469,31 @@ void hex_view(int fd) {
         return;
     }
     
+    size_t map_size = 0;
+    char *map = map_device(fd, &map_size);
     off_t original_pos = lseek(fd, 0, SEEK_CUR);
     lseek(fd, position, SEEK_SET);
     
-    printf("\n" COLOR_CYAN "Hex Dump from position 0x%08lx\n" COLOR_RESET, position);
+    printf("\n" COLOR_CYAN "Hex Dump from position 0x%08lx%s\n" COLOR_RESET, position,
+           map ? " (mmap)" : "");
     printf(COLOR_MAGENTA "══════════════════════════════════════════════════════════\n" COLOR_RESET);
     
     for (int line = 0; line < lines; line++) {
-        ssize_t bytes_read = read(fd, buffer, 16);
+        ssize_t bytes_read;
+        
+        if (map) {
+            // Read straight from the mapping, no syscall per line
+            size_t line_pos = position + line * 16;
+            bytes_read = line_pos < map_size ? (ssize_t)(map_size - line_pos) : 0;
+            if (bytes_read > 16) {
+                bytes_read = 16;
+            }
+            if (bytes_read > 0) {
+                memcpy(buffer, map + line_pos, bytes_read);
+            }
+        } else {
+            bytes_read = read(fd, buffer, 16);
+        }
         
         if (bytes_read <= 0) {
             if (bytes_read < 0) {
@@ -479,6 +532,9 @@ void hex_view(int fd) {
     
     printf(COLOR_MAGENTA "══════════════════════════════════════════════════════════\n" COLOR_RESET);
     
+    if (map) {
+        munmap(map, map_size);
+    }
     lseek(fd, original_pos, SEEK_SET);
 }
 
@@ -755,6 +811,13 @@ void display_stats(int fd) {
     printf("  Write operations:%d\n", stats.write_count);
     printf("  Total:           %d\n", stats.read_count + stats.write_count);
     
+    // Byte totals need the extended stats (older drivers lack them)
+    struct char_stats_ext ext;
+    if (ioctl(fd, CHAR_GET_STATS_EXT, &ext) >= 0) {
+        printf("  Bytes read:      %llu\n", (unsigned long long)ext.read_bytes);
+        printf("  Bytes written:   %llu\n", (unsigned long long)ext.write_bytes);
+    }
+    
     printf("\n" COLOR_GREEN "Performance Indicators:\n" COLOR_RESET);
     if (stats.read_count + stats.write_count > 0) {
         printf("  Read ratio:      %.1f%%\n", 
@@ -895,6 +958,28 @@ void search_pattern(int fd) {
     
     printf("\n" COLOR_CYAN "Searching for '%s'...\n" COLOR_RESET, search_str);
     
+    // Fast path: scan the mapped buffer in place
+    size_t map_size = 0;
+    char *map = map_device(fd, &map_size);
+    if (map) {
+        size_t pattern_len = strlen(search_str);
+        
+        for (size_t i = 0; i + pattern_len <= map_size; i++) {
+            if (memcmp(map + i, search_str, pattern_len) == 0) {
+                printf(COLOR_GREEN "Found at position 0x%08zx (byte %zu)\n" COLOR_RESET, i, i);
+                found++;
+            }
+        }
+        munmap(map, map_size);
+        
+        if (found == 0) {
+            printf(COLOR_YELLOW "Pattern not found\n" COLOR_RESET);
+        } else {
+            printf(COLOR_GREEN "\nTotal occurrences: %d\n" COLOR_RESET, found);
+        }
+        return;
+    }
+    
     off_t original_pos = lseek(fd, 0, SEEK_CUR);
     lseek(fd, 0, SEEK_SET);
     
@@ -1024,8 +1109,8 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, COLOR_RED "Failed to open device: %s\n" COLOR_RESET, strerror(errno));
         fprintf(stderr, "Make sure the driver is loaded:\n");
         fprintf(stderr, "  sudo insmod simple_char.ko\n");
-        fprintf(stderr, "  sudo mknod /dev/simple_char c 240 0\n");
-        fprintf(stderr, "  sudo chmod 666 /dev/simple_char\n");
+        fprintf(stderr, "  sudo mknod /dev/simple_char0 c 240 0\n");
+        fprintf(stderr, "  sudo chmod 666 /dev/simple_char0\n");
         return EXIT_FAILURE;
     }
     
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,9 +11,10 @@
 #include <ctype.h>
 #include <termios.h>
 #include <sys/time.h>
+#include <errno.h>
 
-#define CHAR_DEVICE "/dev/simple_char"
-#define BLOCK_DEVICE "/dev/simple_block"
+#define CHAR_DEVICE "/dev/simple_char0"
+#define BLOCK_DEVICE "/dev/simple_block0"
 #define SECTOR_SIZE 512
 #define MAX_BUFFER_SIZE 65536
 
@@ -68,6 +70,7 @@ void diagnostics_menu(int char_fd, int block_fd);
 void about_screen();
 void* unified_thread_func(void* arg);
 double get_time_ms();
+ssize_t splice_transfer(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len);
 
 // Utility functions
 void clear_screen() {
@@ -89,6 +92,43 @@ double get_time_ms() {
     return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
+// Copy up to @len bytes between two files through a pipe with splice(),
+// so the data moves as kernel pages instead of through a user buffer.
+// Returns the bytes copied or -1 on error.
+ssize_t splice_transfer(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len) {
+    int pipefd[2];
+    ssize_t total = 0;
+    
+    if (pipe(pipefd) < 0)
+        return -1;
+    
+    while ((size_t)total < len) {
+        ssize_t in = splice(in_fd, &in_off, pipefd[1], NULL, len - total, SPLICE_F_MOVE);
+        if (in <= 0) {
+            if (in < 0)
+                total = -1;
+            break;
+        }
+        
+        // Drain the pipe completely before filling it again
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], NULL, out_fd, &out_off, in, SPLICE_F_MOVE);
+            if (out <= 0) {
+                total = -1;
+                break;
+            }
+            in -= out;
+            total += out;
+        }
+        if (in > 0)
+            break;
+    }
+    
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return total;
+}
+
 void print_status(int char_fd, int block_fd) {
     printf(COLOR_BOLD "DEVICE STATUS:\n" COLOR_RESET);
     printf(COLOR_MAGENTA "──────────────────────────────────────────────────────\n" COLOR_RESET);
@@ -97,7 +137,7 @@ void print_status(int char_fd, int block_fd) {
     if (char_fd >= 0) {
         struct char_stats char_stats;
         if (ioctl(char_fd, CHAR_GET_STATS, &char_stats) >= 0) {
-            printf(COLOR_GREEN "● Character Device: " COLOR_WHITE "/dev/simple_char\n" COLOR_RESET);
+            printf(COLOR_GREEN "● Character Device: " COLOR_WHITE "/dev/simple_char0\n" COLOR_RESET);
             printf("  Buffer: %d/%d bytes | Ops: R:%d W:%d\n",
                    char_stats.buffer_used, char_stats.buffer_size,
                    char_stats.read_count, char_stats.write_count);
@@ -112,7 +152,7 @@ void print_status(int char_fd, int block_fd) {
     if (block_fd >= 0) {
         unsigned long sectors;
         if (ioctl(block_fd, BLKGETSIZE, &sectors) >= 0) {
-            printf(COLOR_GREEN "● Block Device: " COLOR_WHITE "/dev/simple_block\n" COLOR_RESET);
+            printf(COLOR_GREEN "● Block Device: " COLOR_WHITE "/dev/simple_block0\n" COLOR_RESET);
             printf("  Size: %lu sectors (%.2f MB)\n", 
                    sectors, (sectors * SECTOR_SIZE) / (1024.0 * 1024.0));
         } else {
@@ -521,32 +561,41 @@ void transfer_menu(int char_fd, int block_fd) {
         
         switch (choice) {
             case 1: {  // Char → Block
-                char buffer[MAX_BUFFER_SIZE];
+                unsigned long sector = 0;
+                off_t offset = sector * SECTOR_SIZE;
+                unsigned long long block_size = 0;
                 
-                // Read from character device
-                lseek(char_fd, 0, SEEK_SET);
-                ssize_t char_bytes = read(char_fd, buffer, sizeof(buffer));
+                if (ioctl(block_fd, BLKGETSIZE64, &block_size) < 0) {
+                    printf(COLOR_RED "Failed to get block device size\n" COLOR_RESET);
+                    break;
+                }
                 
-                if (char_bytes <= 0) {
+                // splice() the character buffer straight into the block
+                // device; no user-space bounce buffer is involved
+                ssize_t char_bytes = splice_transfer(char_fd, 0, block_fd, offset, block_size);
+                
+                if (char_bytes < 0) {
+                    printf(COLOR_RED "Transfer failed: %s\n" COLOR_RESET, strerror(errno));
+                    break;
+                }
+                if (char_bytes == 0) {
                     printf(COLOR_YELLOW "Character device is empty\n" COLOR_RESET);
                     break;
                 }
                 
-                // Write to block device
-                unsigned long sector = 0;
-                off_t offset = sector * SECTOR_SIZE;
-                lseek(block_fd, offset, SEEK_SET);
-                
                 // Ensure we write full sectors
                 size_t bytes_to_write = char_bytes;
+                ssize_t block_bytes = char_bytes;
                 if (bytes_to_write % SECTOR_SIZE != 0) {
-                    bytes_to_write = ((bytes_to_write / SECTOR_SIZE) + 1) * SECTOR_SIZE;
-                    memset(buffer + char_bytes, 0, bytes_to_write - char_bytes);
+                    char zeros[SECTOR_SIZE] = {0};
+                    size_t pad = SECTOR_SIZE - bytes_to_write % SECTOR_SIZE;
+                    
+                    if (pwrite(block_fd, zeros, pad, offset + char_bytes) == (ssize_t)pad)
+                        block_bytes += pad;
+                    bytes_to_write += pad;
                 }
                 
-                ssize_t block_bytes = write(block_fd, buffer, bytes_to_write);
-                
-                if (block_bytes == bytes_to_write) {
+                if (block_bytes == (ssize_t)bytes_to_write) {
                     printf(COLOR_GREEN "Copied %ld bytes to block device sector %lu\n" COLOR_RESET,
                            char_bytes, sector);
                     printf("Used %ld sectors\n", bytes_to_write / SECTOR_SIZE);
@@ -1137,8 +1186,8 @@ void about_screen() {
     printf(COLOR_BLUE "USAGE NOTES:\n" COLOR_RESET);
     printf("1. Both drivers must be loaded before using this application\n");
     printf("2. Run with sudo for device access privileges\n");
-    printf("3. Character device: /dev/simple_char\n");
-    printf("4. Block device: /dev/simple_block\n");
+    printf("3. Character device: /dev/simple_char0\n");
+    printf("4. Block device: /dev/simple_block0\n");
     printf("\n");
     
     printf(COLOR_MAGENTA "COMMAND LINE OPTIONS:\n" COLOR_RESET);
@@ -9,7 +9,7 @@
 #include <ctype.h>
 #include <time.h>
 
-#define DEVICE_PATH "/dev/simple_block"
+#define DEVICE_PATH "/dev/simple_block0"
 #define SECTOR_SIZE 512
 #define MAX_SECTORS 65536
 #define BUFFER_SIZE (SECTOR_SIZE * 16)  // 8KB buffer
@@ -1,16 +1,40 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
-#include <linux/genhd.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
-#include <linux/vmalloc.h>
-#include <linux/mutex.h>
+#include <linux/highmem.h>
+#include <linux/xarray.h>
+#include <linux/rwsem.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
 #include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/file.h>
+#include <linux/falloc.h>
+#include <linux/uio.h>
+#include <linux/ioprio.h>
+#include <linux/xxhash.h>
+#include <linux/zsmalloc.h>
+#include <linux/crypto.h>
+#include <linux/local_lock.h>
+#include <linux/workqueue.h>
+#include <linux/sched/mm.h>
+
+#define CREATE_TRACE_POINTS
+#include "simple_block_trace.h"
 
 #define DEVICE_NAME "simple_block"
-#define SECTOR_SIZE 512
 #define DEFAULT_SECTORS 2048  // 1MB default size
-#define MAX_SECTORS 65536     // 32MB max size
+#define DEFAULT_QUEUE_DEPTH 128
+#define NR_STRIPES 64         // Must be a power of two
+#define MAX_DISKS 16
 
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("Enhanced Block Device Driver");
@@ -18,98 +42,1707 @@ MODULE_LICENSE("GPL");
 MODULE_VERSION("2.0");
 
 static struct block_device_operations block_ops;
-static struct gendisk *simple_disk = NULL;
-static struct request_queue *queue = NULL;
-static u8 *device_data = NULL;
 static int major_number = 0;
-static DEFINE_MUTEX(device_mutex);
 
-static unsigned long device_sectors = DEFAULT_SECTORS;
-static unsigned long read_ops = 0;
-static unsigned long write_ops = 0;
+// Striped lock table. Page N is guarded by stripe N % NR_STRIPES, so
+// I/O to disjoint pages runs in parallel while overlapping I/O to the
+// same page is still serialized (readers share, writers exclude).
+// Lookups and inserts happen under the stripe lock so a concurrent
+// discard cannot free a page while it is being copied.
+struct simple_block_stripe {
+    struct rw_semaphore lock;
+} ____cacheline_aligned_in_smp;
+
+// Log2 latency histogram buckets: bucket 0 counts 0 ns, bucket i counts
+// [2^(i-1), 2^i) ns, and the last bucket also takes everything slower
+#define LAT_HIST_BUCKETS 32
+
+// Block-side ioctl, op 0 = read, 1 = write
+#define SIMPLE_BLOCK_IOCTL_MAGIC 'B'
+#define SIMPLE_BLOCK_GET_LATENCY_HIST _IOWR(SIMPLE_BLOCK_IOCTL_MAGIC, 1, struct simple_block_latency_hist)
+
+struct simple_block_latency_hist {
+    __u32 op;               // In
+    __u32 nr_buckets;       // Out: LAT_HIST_BUCKETS
+    __u64 buckets[LAT_HIST_BUCKETS];
+};
+
+// Per-CPU operation counters and request latency histograms (indexed by
+// data direction), summed only when reported
+struct simple_block_stats {
+    unsigned long read_ops;
+    unsigned long write_ops;
+    unsigned long discard_ops;
+    unsigned long same_writes;
+    unsigned long flush_ops;
+    unsigned long lat_hist[2][LAT_HIST_BUCKETS];
+};
+
+// Token bucket for the performance model. Tokens may go negative: the
+// debt is how long the request that caused it has to wait.
+struct simple_block_bucket {
+    s64 tokens;
+    u64 last_ns;
+};
+
+// Optional device performance model, set through sysfs. Requests still
+// complete their data copy inline; the model only decides when each one
+// is reported complete, and defers that with an hrtimer. All knobs zero
+// means the model is off and requests complete immediately.
+struct simple_block_model {
+    spinlock_t lock;            // Guards the buckets
+    bool active;
+    u64 latency_ns;             // Fixed per-request latency
+    u64 ns_per_kb;              // Additional latency per KB transferred
+    u64 bandwidth_kbps;         // Bandwidth cap in KB/s
+    u64 iops;                   // Request rate cap
+    u64 queue_depth;            // Requests in flight before pushing back
+    u64 flush_latency_ns;       // Fixed cost of a flush or FUA write
+    u64 flush_ns_per_kb;        // Additional cost per KB made durable
+    struct simple_block_bucket bw;
+    struct simple_block_bucket ops;
+    atomic_t inflight;
+    atomic_t waiting;           // Requests were turned away by queue_depth
+};
+
+// Per-request driver data (tag_set.cmd_size)
+struct simple_block_cmd {
+    struct hrtimer timer;
+    struct work_struct work;    // File-backed I/O runs from sb->wq
+    struct kiocb iocb;          // File-backed I/O
+    struct bio_vec *bvec;       // Flattened vector of a multi-bio request
+    atomic_t ref;               // Submitter and kiocb completion
+    long ret;                   // kiocb result
+    u64 start_ns;
+    blk_status_t status;
+    bool counted;               // Holds a model.inflight slot
+    bool update_cache;          // Write done, worker syncs the cache
+    u64 flush_bytes;            // Bytes a flush destaged or FUA wrote
+};
+
+// Compressed mode: a slot holds one of these instead of a page. Objects
+// of PAGE_SIZE are pages that did not compress and are stored raw.
+struct simple_block_zobj {
+    unsigned long handle;       // zsmalloc object
+    unsigned int len;
+};
+
+// Dedup mode: a dedup_index entry, the shared page and the number of
+// slots mapping it. The count is the driver's own rather than the page
+// refcount, which anyone may raise for a moment (memory-failure, page
+// scanners); the entry holds the driver's single page reference.
+struct simple_block_dedup_ent {
+    struct page *page;
+    unsigned long refs;
+};
+
+// Per-CPU compression stream, shared by all disks
+struct simple_block_zstrm {
+    local_lock_t lock;
+    struct crypto_comp *tfm;
+    u8 *buffer;                 // Compressor output, two pages
+    u8 *page;                   // Page being rebuilt by a partial write
+};
+
+static struct simple_block_zstrm __percpu *zstrms;
+
+// One instance per /dev/simple_blockN. Disks share nothing on the I/O
+// path: each has its own tag set and queue, page store, lock stripes
+// and statistics.
+struct simple_block_dev {
+    int index;
+    sector_t sectors;
+    struct gendisk *disk;
+    struct blk_mq_tag_set tag_set;
+    
+    // Sparse backing store: one page per slot, keyed by page index.
+    // Pages are allocated on first write and freed again by discard;
+    // holes read back as zeros. With a backing file the same store is
+    // a write-through cache in front of it, and a missing page is a
+    // cache miss instead.
+    //
+    // On RAM disks a page whose bytes are all equal is not stored at
+    // all: its slot holds the fill byte as an xarray value entry, and an
+    // all-zero page simply becomes a hole. nr_pages counts stored pages,
+    // nr_filled the value entries.
+    struct xarray pages;
+    atomic_long_t nr_pages;
+    atomic_long_t nr_filled;
+    struct file *backing;
+    struct workqueue_struct *wq;
+    
+    // Dedup mode (RAM disks only): stored pages are immutable and may
+    // back several slots. dedup_index maps a content hash (kept in
+    // page_private) to a simple_block_dedup_ent for one page with that
+    // hash. A page missing from the index (hash collision) has one slot.
+    bool dedup;
+    spinlock_t dedup_lock;      // Guards dedup_index and entry refcounts
+    struct xarray dedup_index;
+    atomic_long_t nr_phys;
+    atomic_long_t nr_indexed;
+    
+    // Compressed mode (RAM disks only): slots hold simple_block_zobj
+    struct zs_pool *zpool;
+    atomic64_t compr_bytes;
+    atomic_long_t huge_pages;
+    
+    // Volatile write-back cache (RAM disks, write_cache_mb): dirty pages
+    // not yet in the page store, keyed and locked like it. Reads look
+    // here first; REQ_OP_FLUSH and FUA writes destage into the store.
+    struct xarray wc_pages;
+    long wc_max;
+    atomic_long_t wc_nr;
+    atomic_long_t wc_destaged;
+    
+    struct simple_block_stats __percpu *stats;
+    struct simple_block_model model;
+    struct simple_block_stripe stripes[NR_STRIPES];
+};
+
+static struct simple_block_dev *sb_devs;
+
+static unsigned int num_disks = 1;
+module_param(num_disks, uint, 0444);
+MODULE_PARM_DESC(num_disks, "Number of /dev/simple_blockN disks (default: 1, max: 16)");
+
+// Per-disk capacity. A shorter list repeats its last value, so a single
+// value sizes every disk.
+static unsigned long device_sectors[MAX_DISKS] = {
+    [0 ... MAX_DISKS - 1] = DEFAULT_SECTORS
+};
+static int nr_device_sectors;
+module_param_array(device_sectors, ulong, &nr_device_sectors, 0444);
+MODULE_PARM_DESC(device_sectors, "Per-disk capacity in 512-byte sectors, comma separated (default: 2048)");
+
+// Minors reserved per disk; anything above 1 enables partition scanning
+// and allows up to part_minors - 1 partitions (simple_block0p1, ...)
+static unsigned int part_minors = 1;
+module_param(part_minors, uint, 0444);
+MODULE_PARM_DESC(part_minors, "Minors per disk, 1 disables partitions (default: 1, max: 256)");
+
+static bool dedup = false;
+module_param(dedup, bool, 0444);
+MODULE_PARM_DESC(dedup, "Share identical pages between slots of RAM disks, copy-on-write (default: off)");
+
+// Compression algorithm for RAM disk pages, any the crypto API provides
+// (e.g. "lz4", "lzo", "zstd"); unset keeps pages uncompressed
+static char *compress;
+module_param(compress, charp, 0444);
+MODULE_PARM_DESC(compress, "Compress RAM disk pages with this crypto algorithm, e.g. lz4 or zstd (default: off)");
+
+// Per-disk backing files. A disk with a backing file keeps its data in
+// the file across reloads, and its size follows the file unless
+// device_sectors is given for that disk.
+static char *backing_file[MAX_DISKS];
+static int nr_backing_files;
+module_param_array(backing_file, charp, &nr_backing_files, 0444);
+MODULE_PARM_DESC(backing_file, "Per-disk backing file paths, comma separated (default: none, RAM only)");
+
+static unsigned int backing_cache_mb = 0;
+module_param(backing_cache_mb, uint, 0444);
+MODULE_PARM_DESC(backing_cache_mb, "RAM cache in front of each backing file in MB, 0 disables (default: 0)");
+
+// A RAM disk with a write-back cache advertises one to the block layer,
+// acknowledges writes once they are cached and only moves them into the
+// page store on flush. File-backed disks always advertise a cache and
+// flush by fsync of the backing file.
+static unsigned int write_cache_mb = 0;
+module_param(write_cache_mb, uint, 0444);
+MODULE_PARM_DESC(write_cache_mb, "Volatile write-back cache per RAM disk in MB, destaged on flush; 0 disables (default: 0)");
+
+// Queue limits, applied to every disk. Zero leaves a limit at the block
+// layer default; physical_block_size 0 follows logical_block_size.
+static unsigned int logical_block_size = SECTOR_SIZE;
+module_param(logical_block_size, uint, 0444);
+MODULE_PARM_DESC(logical_block_size, "Logical block size in bytes, power of two from 512 to PAGE_SIZE (default: 512)");
+
+static unsigned int physical_block_size = 0;
+module_param(physical_block_size, uint, 0444);
+MODULE_PARM_DESC(physical_block_size, "Physical block size in bytes (default: logical_block_size)");
+
+static unsigned int io_min = 0;
+module_param(io_min, uint, 0444);
+MODULE_PARM_DESC(io_min, "Minimum preferred I/O size in bytes (default: physical block size)");
+
+static unsigned int io_opt = 0;
+module_param(io_opt, uint, 0444);
+MODULE_PARM_DESC(io_opt, "Optimal I/O size in bytes (default: 0, none)");
+
+static unsigned int max_hw_sectors_kb = 0;
+module_param(max_hw_sectors_kb, uint, 0444);
+MODULE_PARM_DESC(max_hw_sectors_kb, "Largest request in KB (default: block layer default)");
+
+static unsigned int max_segments = 0;
+module_param(max_segments, uint, 0444);
+MODULE_PARM_DESC(max_segments, "Maximum segments per request (default: block layer default)");
+
+static unsigned int max_segment_size = 0;
+module_param(max_segment_size, uint, 0444);
+MODULE_PARM_DESC(max_segment_size, "Maximum segment size in bytes, at least PAGE_SIZE (default: block layer default)");
+
+// Number of blk-mq hardware queues, 0 means one per online CPU
+static unsigned int hw_queues = 0;
+module_param(hw_queues, uint, 0444);
+MODULE_PARM_DESC(hw_queues, "Number of hardware queues (default: one per online CPU)");
 
-// Block device request processing
-static void simple_block_request(struct request_queue *q) {
-    struct request *req;
+static unsigned int queue_depth = DEFAULT_QUEUE_DEPTH;
+module_param(queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "Tags per hardware queue (default: 128)");
+
+// Per-I/O debug logging. The static key keeps the check out of the hot
+// path entirely while debug_level is 0; use the simple_block tracepoints
+// for routine per-request visibility.
+static DEFINE_STATIC_KEY_FALSE(debug_enabled);
+static unsigned int debug_level = 0;
+
+static int debug_level_set(const char *val, const struct kernel_param *kp) {
+    int ret = param_set_uint(val, kp);
+    
+    if (ret)
+        return ret;
+    if (debug_level)
+        static_branch_enable(&debug_enabled);
+    else
+        static_branch_disable(&debug_enabled);
+    return 0;
+}
+
+static const struct kernel_param_ops debug_level_ops = {
+    .set = debug_level_set,
+    .get = param_get_uint,
+};
+module_param_cb(debug_level, &debug_level_ops, &debug_level, 0644);
+MODULE_PARM_DESC(debug_level, "Debug log level: 0=off, 1=requests, 2=segments");
+
+#define sb_debug(level, fmt, ...)                                           \
+    do {                                                                    \
+        if (static_branch_unlikely(&debug_enabled) && debug_level >= (level)) \
+            printk(KERN_DEBUG "SimpleBlock: " fmt, ##__VA_ARGS__);          \
+    } while (0)
+
+// Return the page backing @pos, allocating a zeroed one on first write
+static struct page *simple_block_insert_page(struct simple_block_dev *sb,
+                                             loff_t pos, gfp_t gfp) {
+    pgoff_t idx = pos >> PAGE_SHIFT;
+    struct page *page, *old, *cur;
+    
+    old = xa_load(&sb->pages, idx);
+    if (old && !xa_is_value(old))
+        return old;
+    
+    page = alloc_page(gfp | __GFP_ZERO | __GFP_HIGHMEM);
+    if (!page)
+        return NULL;
+    
+    // A same-filled slot becomes a real page holding its fill byte
+    if (old)
+        memset_page(page, 0, xa_to_value(old), PAGE_SIZE);
+    
+    // Another writer may have raced us to the same slot
+    cur = xa_cmpxchg(&sb->pages, idx, old, page, gfp);
+    if (unlikely(cur != old)) {
+        __free_page(page);
+        return xa_is_err(cur) || xa_is_value(cur) ? NULL : cur;
+    }
+    
+    if (old)
+        atomic_long_dec(&sb->nr_filled);
+    atomic_long_inc(&sb->nr_pages);
+    return page;
+}
+
+static inline struct rw_semaphore *simple_block_stripe_lock(struct simple_block_dev *sb,
+                                                            loff_t pos) {
+    return &sb->stripes[(pos >> PAGE_SHIFT) & (NR_STRIPES - 1)].lock;
+}
+
+// Drop one slot's reference to a dedup page, unindexing and freeing it
+// with the last one
+static void simple_block_dedup_put(struct simple_block_dev *sb, struct page *page) {
+    struct simple_block_dedup_ent *ent;
+    
+    spin_lock(&sb->dedup_lock);
+    ent = xa_load(&sb->dedup_index, page_private(page));
+    if (ent && ent->page == page) {
+        if (--ent->refs) {
+            spin_unlock(&sb->dedup_lock);
+            return;
+        }
+        xa_erase(&sb->dedup_index, page_private(page));
+        atomic_long_dec(&sb->nr_indexed);
+        kfree(ent);
+    }
+    atomic_long_dec(&sb->nr_phys);
+    set_page_private(page, 0);
+    spin_unlock(&sb->dedup_lock);
+    put_page(page);
+}
+
+static void simple_block_zfree(struct simple_block_dev *sb, struct simple_block_zobj *obj) {
+    zs_free(sb->zpool, obj->handle);
+    atomic64_sub(obj->len, &sb->compr_bytes);
+    if (obj->len == PAGE_SIZE)
+        atomic_long_dec(&sb->huge_pages);
+    kfree(obj);
+}
+
+// Free whatever a RAM disk slot held once it has left the xarray
+static void simple_block_release(struct simple_block_dev *sb, void *entry) {
+    if (!entry)
+        return;
+    if (xa_is_value(entry)) {
+        atomic_long_dec(&sb->nr_filled);
+        return;
+    }
+    
+    if (sb->zpool)
+        simple_block_zfree(sb, entry);
+    else if (sb->dedup)
+        simple_block_dedup_put(sb, entry);
+    else
+        __free_page(entry);
+    atomic_long_dec(&sb->nr_pages);
+}
+
+// Store a whole-page write to a RAM disk as its fill byte if every byte
+// of @src is the same, called with the slot's stripe lock held for write.
+// memchr_inv() compares a word at a time and stops at the first
+// mismatch, so ordinary data costs a few loads before the normal path.
+static bool simple_block_store_filled(struct simple_block_dev *sb, const void *src,
+                                      loff_t pos, unsigned int chunk) {
+    pgoff_t idx = pos >> PAGE_SHIFT;
+    u8 fill;
+    void *old;
+    
+    if (sb->backing || chunk != PAGE_SIZE)
+        return false;
+    fill = *(const u8 *)src;
+    if (memchr_inv(src, fill, PAGE_SIZE))
+        return false;
+    
+    if (fill) {
+        old = xa_store(&sb->pages, idx, xa_mk_value(fill), GFP_NOIO);
+        if (xa_is_err(old))
+            return false;
+        atomic_long_inc(&sb->nr_filled);
+    } else {
+        old = xa_erase(&sb->pages, idx);
+    }
+    simple_block_release(sb, old);
+    this_cpu_inc(sb->stats->same_writes);
+    return true;
+}
+
+// Copy-on-write store for dedup mode, called with the slot's stripe lock
+// held for write. The new contents of the page (@src, or zeros if NULL,
+// over the old contents) are built in a fresh page and hashed; an
+// identical indexed page is shared instead when there is one.
+static int simple_block_dedup_store(struct simple_block_dev *sb, const void *src,
+                                    loff_t pos, unsigned int offset, unsigned int chunk) {
+    pgoff_t idx = pos >> PAGE_SHIFT;
+    struct page *old = xa_load(&sb->pages, idx);
+    struct simple_block_dedup_ent *ent, *new_ent;
+    struct page *page, *dup = NULL, *cur;
+    void *data, *dup_data;
+    u64 hash;
+    
+    page = alloc_page(GFP_NOIO | __GFP_HIGHMEM |
+                      (chunk < PAGE_SIZE || !src ? __GFP_ZERO : 0));
+    if (!page)
+        return -ENOMEM;
+    // Index entry for the page if it turns out to be new; without one
+    // the page is just stored unindexed
+    new_ent = kmalloc(sizeof(*new_ent), GFP_NOIO);
+    if (xa_is_value(old) && chunk < PAGE_SIZE)
+        memset_page(page, 0, xa_to_value(old), PAGE_SIZE);
+    else if (old && chunk < PAGE_SIZE)
+        copy_highpage(page, old);
+    if (src)
+        memcpy_to_page(page, offset, src, chunk);
+    else if (old)
+        memzero_page(page, offset, chunk);
+    
+    data = kmap_local_page(page);
+    hash = xxh64(data, PAGE_SIZE, 0);
+    
+    spin_lock(&sb->dedup_lock);
+    ent = xa_load(&sb->dedup_index, (unsigned long)hash);
+    if (ent) {
+        dup_data = kmap_local_page(ent->page);
+        if (!memcmp(dup_data, data, PAGE_SIZE))
+            dup = ent->page;
+        kunmap_local(dup_data);
+    }
+    if (dup) {
+        ent->refs++;
+    } else {
+        // A hash collision leaves the new page private, not indexed
+        set_page_private(page, (unsigned long)hash);
+        if (!ent && new_ent) {
+            new_ent->page = page;
+            new_ent->refs = 1;
+            if (!xa_is_err(xa_store(&sb->dedup_index, (unsigned long)hash,
+                                    new_ent, GFP_ATOMIC))) {
+                atomic_long_inc(&sb->nr_indexed);
+                new_ent = NULL;
+            }
+        }
+        atomic_long_inc(&sb->nr_phys);
+    }
+    spin_unlock(&sb->dedup_lock);
+    kunmap_local(data);
+    kfree(new_ent);
+    
+    if (dup) {
+        __free_page(page);
+        page = dup;
+    }
+    
+    cur = xa_store(&sb->pages, idx, page, GFP_NOIO);
+    if (xa_is_err(cur)) {
+        simple_block_dedup_put(sb, page);
+        return xa_err(cur);
+    }
+    simple_block_release(sb, old);
+    atomic_long_inc(&sb->nr_pages);
+    return 0;
+}
+
+// Decompress @obj into the page-sized buffer @dst, with @zs held
+static int simple_block_zload(struct simple_block_dev *sb, struct simple_block_zstrm *zs,
+                              struct simple_block_zobj *obj, void *dst) {
+    unsigned int dlen = PAGE_SIZE;
+    void *src;
+    int ret = 0;
+    
+    src = zs_map_object(sb->zpool, obj->handle, ZS_MM_RO);
+    if (obj->len == PAGE_SIZE)
+        memcpy(dst, src, PAGE_SIZE);
+    else
+        ret = crypto_comp_decompress(zs->tfm, src, obj->len, dst, &dlen);
+    zs_unmap_object(sb->zpool, obj->handle);
+    
+    if (ret || dlen != PAGE_SIZE) {
+        printk(KERN_ERR "SimpleBlock: Decompression failed (%d)\n", ret);
+        return -EIO;
+    }
+    return 0;
+}
+
+// Compressed store, called with the slot's stripe lock held for write.
+// The page's new contents (@src, or zeros if NULL, over the old
+// contents) are compressed with this CPU's stream into a new object that
+// replaces the slot's old one.
+static int simple_block_zstore(struct simple_block_dev *sb, const void *src,
+                               loff_t pos, unsigned int offset, unsigned int chunk) {
+    pgoff_t idx = pos >> PAGE_SHIFT;
+    struct simple_block_zobj *old = xa_load(&sb->pages, idx);
+    struct simple_block_zobj *obj;
+    struct simple_block_zstrm *zs;
+    unsigned long handle = 0;
+    unsigned int clen, alloc_len = 0;
+    const void *data, *out;
+    void *dst, *cur;
+    int ret;
+    
+    obj = kmalloc(sizeof(*obj), GFP_NOIO);
+    if (!obj)
+        return -ENOMEM;
+    
+retry:
+    local_lock(&zstrms->lock);
+    zs = this_cpu_ptr(zstrms);
+    
+    // Whole-page writes compress straight from the request buffer
+    if (src && chunk == PAGE_SIZE) {
+        data = src;
+    } else {
+        if (!old)
+            memset(zs->page, 0, PAGE_SIZE);
+        else if (xa_is_value(old))
+            memset(zs->page, xa_to_value(old), PAGE_SIZE);
+        else if (simple_block_zload(sb, zs, old, zs->page))
+            goto out_unlock;
+        if (src)
+            memcpy(zs->page + offset, src, chunk);
+        else
+            memset(zs->page + offset, 0, chunk);
+        data = zs->page;
+    }
+    
+    clen = 2 * PAGE_SIZE;
+    ret = crypto_comp_compress(zs->tfm, data, PAGE_SIZE, zs->buffer, &clen);
+    out = zs->buffer;
+    if (ret || clen >= PAGE_SIZE) {
+        // Incompressible: store the page itself
+        clen = PAGE_SIZE;
+        out = data;
+    }
+    
+    if (handle && clen != alloc_len) {
+        zs_free(sb->zpool, handle);
+        handle = 0;
+    }
+    if (!handle) {
+        handle = zs_malloc(sb->zpool, clen, __GFP_KSWAPD_RECLAIM | __GFP_NOWARN |
+                                            __GFP_HIGHMEM | __GFP_MOVABLE);
+        if (IS_ERR_VALUE(handle)) {
+            // Allocate again where we may sleep, then compress again: by
+            // then we may be on another CPU with another stream
+            local_unlock(&zstrms->lock);
+            handle = zs_malloc(sb->zpool, clen, GFP_NOIO | __GFP_HIGHMEM | __GFP_MOVABLE);
+            if (IS_ERR_VALUE(handle)) {
+                kfree(obj);
+                return -ENOMEM;
+            }
+            alloc_len = clen;
+            goto retry;
+        }
+    }
+    
+    dst = zs_map_object(sb->zpool, handle, ZS_MM_WO);
+    memcpy(dst, out, clen);
+    zs_unmap_object(sb->zpool, handle);
+    local_unlock(&zstrms->lock);
+    
+    obj->handle = handle;
+    obj->len = clen;
+    atomic64_add(clen, &sb->compr_bytes);
+    if (clen == PAGE_SIZE)
+        atomic_long_inc(&sb->huge_pages);
+    
+    cur = xa_store(&sb->pages, idx, obj, GFP_NOIO);
+    if (xa_is_err(cur)) {
+        simple_block_zfree(sb, obj);
+        return xa_err(cur);
+    }
+    simple_block_release(sb, old);
+    atomic_long_inc(&sb->nr_pages);
+    return 0;
+    
+out_unlock:
+    local_unlock(&zstrms->lock);
+    if (handle)
+        zs_free(sb->zpool, handle);
+    kfree(obj);
+    return -EIO;
+}
+
+// Compressed read of one chunk, called with the slot's stripe lock held
+static int simple_block_zread(struct simple_block_dev *sb, void *dst, loff_t pos,
+                              unsigned int offset, unsigned int chunk) {
+    struct simple_block_zobj *obj = xa_load(&sb->pages, pos >> PAGE_SHIFT);
+    struct simple_block_zstrm *zs;
+    int ret;
+    
+    if (!obj || xa_is_value(obj)) {
+        memset(dst, obj ? xa_to_value(obj) : 0, chunk);
+        return 0;
+    }
+    
+    local_lock(&zstrms->lock);
+    zs = this_cpu_ptr(zstrms);
+    if (chunk == PAGE_SIZE) {
+        ret = simple_block_zload(sb, zs, obj, dst);
+    } else {
+        ret = simple_block_zload(sb, zs, obj, zs->page);
+        if (!ret)
+            memcpy(dst, zs->page + offset, chunk);
+    }
+    local_unlock(&zstrms->lock);
+    return ret;
+}
+
+// Write one chunk into the page store, with its stripe lock held for write
+static int simple_block_write_chunk(struct simple_block_dev *sb, const void *src,
+                                    loff_t pos, unsigned int offset, unsigned int chunk) {
+    struct page *page;
+    
+    if (simple_block_store_filled(sb, src, pos, chunk))
+        return 0;
+    if (sb->zpool)
+        return simple_block_zstore(sb, src, pos, offset, chunk);
+    if (sb->dedup)
+        return simple_block_dedup_store(sb, src, pos, offset, chunk);
+    
+    page = simple_block_insert_page(sb, pos, GFP_NOIO);
+    if (!page)
+        return -ENOMEM;
+    memcpy_to_page(page, offset, src, chunk);
+    return 0;
+}
+
+// Read one chunk from the page store, with its stripe lock held.
+// Never-written ranges read as zeros without allocating.
+static int simple_block_read_chunk(struct simple_block_dev *sb, void *dst,
+                                   loff_t pos, unsigned int offset, unsigned int chunk) {
+    struct page *page;
+    
+    if (sb->zpool)
+        return simple_block_zread(sb, dst, pos, offset, chunk);
+    
+    page = xa_load(&sb->pages, pos >> PAGE_SHIFT);
+    if (xa_is_value(page))
+        memset(dst, xa_to_value(page), chunk);
+    else if (page)
+        memcpy_from_page(dst, page, offset, chunk);
+    else
+        memset(dst, 0, chunk);
+    return 0;
+}
+
+// Return the write cache page for @pos, adding one filled from the page
+// store while the cache is below write_cache_mb. NULL means the chunk
+// has to be written through.
+static struct page *simple_block_wc_page(struct simple_block_dev *sb, loff_t pos,
+                                         unsigned int chunk) {
+    pgoff_t idx = pos >> PAGE_SHIFT;
+    struct page *page = xa_load(&sb->wc_pages, idx);
+    void *data;
+    int ret = 0;
+    
+    if (page || atomic_long_read(&sb->wc_nr) >= sb->wc_max)
+        return page;
+    
+    page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+    if (!page)
+        return NULL;
+    if (chunk < PAGE_SIZE) {
+        data = kmap_local_page(page);
+        ret = simple_block_read_chunk(sb, data, pos & PAGE_MASK, 0, PAGE_SIZE);
+        kunmap_local(data);
+    }
+    if (ret || xa_is_err(xa_store(&sb->wc_pages, idx, page, GFP_NOIO))) {
+        __free_page(page);
+        return NULL;
+    }
+    
+    atomic_long_inc(&sb->wc_nr);
+    return page;
+}
+
+// Move a dirty page from the write cache into the page store, with its
+// stripe lock held for write. On failure the page stays dirty.
+static int simple_block_wc_destage(struct simple_block_dev *sb, pgoff_t idx,
+                                   struct page *page) {
+    void *data = kmap_local_page(page);
+    int ret = simple_block_write_chunk(sb, data, (loff_t)idx << PAGE_SHIFT, 0, PAGE_SIZE);
+    
+    kunmap_local(data);
+    if (ret)
+        return ret;
+    
+    xa_erase(&sb->wc_pages, idx);
+    __free_page(page);
+    atomic_long_dec(&sb->wc_nr);
+    atomic_long_inc(&sb->wc_destaged);
+    return 0;
+}
+
+// With @cache set, writes land in the write-back cache while it has
+// room. Otherwise (write-through, FUA) a page already dirty in the cache
+// is updated and destaged so it cannot shadow the newer data.
+static int simple_block_copy_to_dev(struct simple_block_dev *sb, const void *src,
+                                    loff_t pos, unsigned int len, bool cache) {
+    while (len) {
+        unsigned int offset = offset_in_page(pos);
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, pos);
+        pgoff_t idx = pos >> PAGE_SHIFT;
+        struct page *page;
+        int ret = 0;
+        
+        down_write(lock);
+        page = cache ? simple_block_wc_page(sb, pos, chunk) : xa_load(&sb->wc_pages, idx);
+        if (page) {
+            memcpy_to_page(page, offset, src, chunk);
+            if (!cache)
+                ret = simple_block_wc_destage(sb, idx, page);
+        } else {
+            ret = simple_block_write_chunk(sb, src, pos, offset, chunk);
+        }
+        up_write(lock);
+        if (ret)
+            return ret;
+        
+        src += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int simple_block_copy_from_dev(struct simple_block_dev *sb, void *dst,
+                                      loff_t pos, unsigned int len) {
+    while (len) {
+        unsigned int offset = offset_in_page(pos);
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, pos);
+        struct page *page;
+        int ret = 0;
+        
+        down_read(lock);
+        page = xa_load(&sb->wc_pages, pos >> PAGE_SHIFT);
+        if (page)
+            memcpy_from_page(dst, page, offset, chunk);
+        else
+            ret = simple_block_read_chunk(sb, dst, pos, offset, chunk);
+        up_read(lock);
+        if (ret)
+            return ret;
+        
+        dst += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// DISCARD / WRITE_ZEROES: pages fully inside [pos, pos + len) are freed
+// so the range reads back as a hole and the memory is returned at once.
+// Partial pages at either end are zeroed in place. REQ_NOUNMAP, which
+// BLKZEROOUT always sets, makes no difference: memory has no provisioning
+// to keep, so freeing is the cheapest way to zero.
+static int simple_block_zero_range(struct simple_block_dev *sb, loff_t pos,
+                                   u64 len) {
+    int ret = 0;
+    
+    while (len) {
+        unsigned int offset = offset_in_page(pos);
+        unsigned int chunk = min_t(u64, len, PAGE_SIZE - offset);
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, pos);
+        pgoff_t idx = pos >> PAGE_SHIFT;
+        struct page *page;
+        
+        down_write(lock);
+        // Dirty cached data in the range goes too
+        page = xa_load(&sb->wc_pages, idx);
+        if (page && chunk == PAGE_SIZE) {
+            xa_erase(&sb->wc_pages, idx);
+            __free_page(page);
+            atomic_long_dec(&sb->wc_nr);
+        } else if (page) {
+            memzero_page(page, offset, chunk);
+        }
+        
+        if (chunk == PAGE_SIZE) {
+            simple_block_release(sb, xa_erase(&sb->pages, idx));
+        } else {
+            page = xa_load(&sb->pages, idx);
+            if (page && sb->zpool)
+                ret = simple_block_zstore(sb, NULL, pos, offset, chunk);
+            else if (page && sb->dedup)
+                ret = simple_block_dedup_store(sb, NULL, pos, offset, chunk);
+            else if (page) {
+                // A same-filled slot needs a real page to zero part of
+                if (xa_is_value(page))
+                    page = simple_block_insert_page(sb, pos, GFP_NOIO);
+                if (page)
+                    memzero_page(page, offset, chunk);
+                else
+                    ret = -ENOMEM;
+            }
+        }
+        up_write(lock);
+        if (ret)
+            return ret;
+        
+        pos += chunk;
+        len -= chunk;
+        cond_resched();
+    }
+    return 0;
+}
+
+// Completion status for a flush that failed with @ret. The data did not
+// become durable, which BLK_STS_RESOURCE ("try again later") would not
+// tell the submitter, so that becomes an I/O error.
+static blk_status_t simple_block_flush_status(int ret) {
+    blk_status_t status = errno_to_blk_status(ret);
+    
+    return status == BLK_STS_RESOURCE ? BLK_STS_IOERR : status;
+}
+
+// REQ_OP_FLUSH on a RAM disk: destage every dirty page, adding the
+// bytes written back to @bytes
+static int simple_block_wc_flush(struct simple_block_dev *sb, u64 *bytes) {
+    struct page *page;
+    unsigned long idx;
+    int ret = 0;
+    
+    xa_for_each(&sb->wc_pages, idx, page) {
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, (loff_t)idx << PAGE_SHIFT);
+        
+        // A FUA write may have destaged the page since the walk saw it
+        down_write(lock);
+        page = xa_load(&sb->wc_pages, idx);
+        if (page)
+            ret = simple_block_wc_destage(sb, idx, page);
+        up_write(lock);
+        if (ret)
+            return ret;
+        if (page)
+            *bytes += PAGE_SIZE;
+        cond_resched();
+    }
+    return 0;
+}
+
+// Throw away every dirty page without destaging it, returning how many
+// were dropped
+static long simple_block_wc_drop(struct simple_block_dev *sb) {
+    struct page *page;
+    unsigned long idx;
+    long dropped = 0;
+    
+    xa_for_each(&sb->wc_pages, idx, page) {
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, (loff_t)idx << PAGE_SHIFT);
+        
+        down_write(lock);
+        page = xa_erase(&sb->wc_pages, idx);
+        if (page) {
+            __free_page(page);
+            atomic_long_dec(&sb->wc_nr);
+            dropped++;
+        }
+        up_write(lock);
+    }
+    return dropped;
+}
+
+// Write-through cache for file-backed disks, updated after the file
+// write succeeds. Cached pages are updated in place, and whole pages are
+// added while the cache is below backing_cache_mb; partial writes to
+// uncached pages only go to the file.
+static void simple_block_cache_update(struct simple_block_dev *sb, const void *src,
+                                      loff_t pos, unsigned int len) {
+    long limit = (long)backing_cache_mb << (20 - PAGE_SHIFT);
+    
+    while (len) {
+        unsigned int offset = offset_in_page(pos);
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, pos);
+        struct page *page;
+        
+        down_write(lock);
+        page = xa_load(&sb->pages, pos >> PAGE_SHIFT);
+        if (!page && chunk == PAGE_SIZE && atomic_long_read(&sb->nr_pages) < limit)
+            page = simple_block_insert_page(sb, pos, GFP_NOIO);
+        if (page)
+            memcpy_to_page(page, offset, src, chunk);
+        up_write(lock);
+        
+        src += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+// Copy a cached range out, returning false at the first uncached page
+static bool simple_block_cache_copy(struct simple_block_dev *sb, void *dst,
+                                    loff_t pos, unsigned int len) {
+    while (len) {
+        unsigned int offset = offset_in_page(pos);
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, pos);
+        struct page *page;
+        
+        down_read(lock);
+        page = xa_load(&sb->pages, pos >> PAGE_SHIFT);
+        if (page)
+            memcpy_from_page(dst, page, offset, chunk);
+        up_read(lock);
+        if (!page)
+            return false;
+        
+        dst += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Drop every cached page @len bytes at @pos touch, so reads of the
+// range go to the file
+static void simple_block_cache_invalidate(struct simple_block_dev *sb, loff_t pos,
+                                          unsigned int len) {
+    pgoff_t idx, last = (pos + len - 1) >> PAGE_SHIFT;
+    
+    if (!backing_cache_mb || !len)
+        return;
+    
+    for (idx = pos >> PAGE_SHIFT; idx <= last; idx++) {
+        struct rw_semaphore *lock = simple_block_stripe_lock(sb, (loff_t)idx << PAGE_SHIFT);
+        
+        down_write(lock);
+        simple_block_release(sb, xa_erase(&sb->pages, idx));
+        up_write(lock);
+    }
+}
+
+static void simple_block_cache_write(struct simple_block_dev *sb, struct request *req) {
+    loff_t pos = (loff_t)blk_rq_pos(req) << SECTOR_SHIFT;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    
+    if (!backing_cache_mb)
+        return;
+    
+    rq_for_each_segment(bvec, req, iter) {
+        void *buffer = bvec_kmap_local(&bvec);
+        
+        simple_block_cache_update(sb, buffer, pos, bvec.bv_len);
+        kunmap_local(buffer);
+        pos += bvec.bv_len;
+    }
+}
+
+// Serve a read from the cache if every page it touches is cached. A
+// partial copy is harmless: the file read overwrites it.
+static bool simple_block_cache_read(struct simple_block_dev *sb, struct request *req) {
+    loff_t pos = (loff_t)blk_rq_pos(req) << SECTOR_SHIFT;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    
+    if (!backing_cache_mb)
+        return false;
+    
+    rq_for_each_segment(bvec, req, iter) {
+        void *buffer = bvec_kmap_local(&bvec);
+        bool hit = simple_block_cache_copy(sb, buffer, pos, bvec.bv_len);
+        
+        kunmap_local(buffer);
+        if (!hit)
+            return false;
+        pos += bvec.bv_len;
+    }
+    return true;
+}
+
+static void simple_block_free_pages(struct simple_block_dev *sb) {
+    struct page *page;
+    unsigned long idx;
+    
+    simple_block_wc_drop(sb);
+    xa_for_each(&sb->pages, idx, page)
+        simple_block_release(sb, page);
+    xa_destroy(&sb->pages);
+    xa_destroy(&sb->dedup_index);
+    if (sb->zpool) {
+        zs_destroy_pool(sb->zpool);
+        sb->zpool = NULL;
+    }
+}
+
+static void simple_block_get_stats(struct simple_block_dev *sb, unsigned long *reads,
+                                   unsigned long *writes, unsigned long *discards) {
+    int cpu;
+    
+    *reads = 0;
+    *writes = 0;
+    *discards = 0;
+    for_each_possible_cpu(cpu) {
+        struct simple_block_stats *stats = per_cpu_ptr(sb->stats, cpu);
+        
+        *reads += READ_ONCE(stats->read_ops);
+        *writes += READ_ONCE(stats->write_ops);
+        *discards += READ_ONCE(stats->discard_ops);
+    }
+}
+
+static void simple_block_get_lat_hist(struct simple_block_dev *sb, bool write,
+                                      u64 *buckets) {
+    int cpu, i;
+    
+    memset(buckets, 0, sizeof(u64) * LAT_HIST_BUCKETS);
+    for_each_possible_cpu(cpu) {
+        struct simple_block_stats *stats = per_cpu_ptr(sb->stats, cpu);
+        
+        for (i = 0; i < LAT_HIST_BUCKETS; i++)
+            buckets[i] += READ_ONCE(stats->lat_hist[write][i]);
+    }
+}
+
+// Refill @b at @rate tokens per second, capped at 10 ms worth of burst,
+// then charge @cost. Returns how long the caller must wait in ns.
+static u64 simple_block_bucket_charge(struct simple_block_bucket *b, u64 rate,
+                                      u64 cost, u64 now) {
+    s64 burst = max_t(u64, rate / 100, 1);
+    u64 refill = mul_u64_u64_div_u64(now - b->last_ns, rate, NSEC_PER_SEC);
+    
+    if (refill >= (u64)(burst - b->tokens))
+        b->tokens = burst;
+    else
+        b->tokens += refill;
+    b->last_ns = now;
+    
+    b->tokens -= cost;
+    if (b->tokens >= 0)
+        return 0;
+    return mul_u64_u64_div_u64(-b->tokens, NSEC_PER_SEC, rate);
+}
+
+// Absolute time (ktime_get_ns) at which the emulated device would finish
+// a request of @bytes payload that arrived at @start_ns
+static u64 simple_block_model_due(struct simple_block_dev *sb, unsigned int bytes,
+                                  u64 start_ns) {
+    struct simple_block_model *m = &sb->model;
+    u64 now = ktime_get_ns();
+    u64 wait = 0;
+    unsigned long flags;
+    
+    // File-backed requests get here from their kiocb completion
+    spin_lock_irqsave(&m->lock, flags);
+    if (m->bandwidth_kbps)
+        wait = simple_block_bucket_charge(&m->bw, m->bandwidth_kbps * 1024, bytes, now);
+    if (m->iops)
+        wait = max(wait, simple_block_bucket_charge(&m->ops, m->iops, 1, now));
+    spin_unlock_irqrestore(&m->lock, flags);
+    
+    return start_ns + wait + READ_ONCE(m->latency_ns) +
+           mul_u64_u64_div_u64(bytes, READ_ONCE(m->ns_per_kb), 1024);
+}
+
+// Report a request complete, either inline from queue_rq or from its
+// model timer (hard irq context)
+static void simple_block_end_cmd(struct request *req) {
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
+    struct request_queue *q = req->q;
+    struct simple_block_dev *sb = q->queuedata;
+    bool write = rq_data_dir(req) == WRITE;
+    bool counted = cmd->counted;
+    u64 latency_ns;
+    
+    // Service time inside the driver, excluding block-layer queueing.
+    // Only data transfers go into the read/write histograms.
+    latency_ns = ktime_get_ns() - cmd->start_ns;
+    if (req_op(req) == REQ_OP_READ || req_op(req) == REQ_OP_WRITE)
+        this_cpu_inc(sb->stats->lat_hist[write][min(fls64(latency_ns), LAT_HIST_BUCKETS - 1)]);
+    
+    trace_simple_block_rq_complete(blk_rq_pos(req), blk_rq_bytes(req), write,
+                                   blk_status_to_errno(cmd->status), latency_ns);
+    
+    // Requests turned away by the model queue depth are waiting on this
+    // slot. Done before ending the request, whose queue reference keeps
+    // the disk alive until the asynchronous rerun has been scheduled.
+    if (counted) {
+        atomic_dec(&sb->model.inflight);
+        smp_mb__after_atomic();
+        if (atomic_xchg(&sb->model.waiting, 0))
+            blk_mq_run_hw_queues(q, true);
+    }
+    
+    blk_mq_end_request(req, cmd->status);
+}
+
+// The request's I/O is done: let the model timer report completion unless
+// it is already due. Discards and flushes move no data, so they only pay
+// latency and IOPS, and flushes and FUA writes add the flush cost for
+// what they made durable.
+static void simple_block_finish_cmd(struct request *req) {
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
+    struct simple_block_dev *sb = req->q->queuedata;
+    
+    kfree(cmd->bvec);
+    cmd->bvec = NULL;
+    
+    if (cmd->counted && cmd->status == BLK_STS_OK) {
+        bool discard = req_op(req) == REQ_OP_DISCARD || req_op(req) == REQ_OP_WRITE_ZEROES;
+        bool flush = req_op(req) == REQ_OP_FLUSH;
+        u64 due = simple_block_model_due(sb, discard || flush ? 0 : blk_rq_bytes(req),
+                                         cmd->start_ns);
+        
+        if (flush || (req->cmd_flags & REQ_FUA))
+            due += READ_ONCE(sb->model.flush_latency_ns) +
+                   mul_u64_u64_div_u64(cmd->flush_bytes, READ_ONCE(sb->model.flush_ns_per_kb), 1024);
+        
+        if (due > ktime_get_ns()) {
+            hrtimer_start(&cmd->timer, ns_to_ktime(due), HRTIMER_MODE_ABS);
+            return;
+        }
+    }
+    
+    simple_block_end_cmd(req);
+}
+
+static enum hrtimer_restart simple_block_timer_fn(struct hrtimer *timer) {
+    struct simple_block_cmd *cmd = container_of(timer, struct simple_block_cmd, timer);
+    
+    simple_block_end_cmd(blk_mq_rq_from_pdu(cmd));
+    return HRTIMER_NORESTART;
+}
+
+static void simple_block_backing_work(struct work_struct *work);
+
+static int simple_block_init_request(struct blk_mq_tag_set *set, struct request *req,
+                                     unsigned int hctx_idx, unsigned int numa_node) {
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
+    
+    hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    cmd->timer.function = simple_block_timer_fn;
+    INIT_WORK(&cmd->work, simple_block_backing_work);
+    return 0;
+}
+
+// Drop one of the two references held by a submitted kiocb. The
+// completion can run before ->read_iter or ->write_iter returns, so the
+// request and its vector stay live until both the submitter and the
+// completion are done with them.
+static void simple_block_aio_put(struct simple_block_cmd *cmd) {
+    struct request *req = blk_mq_rq_from_pdu(cmd);
+    struct simple_block_dev *sb = req->q->queuedata;
+    
+    if (!atomic_dec_and_test(&cmd->ref))
+        return;
+    
+    if (req_op(req) == REQ_OP_WRITE)
+        kiocb_end_write(&cmd->iocb);
+    
+    if (cmd->ret == blk_rq_bytes(req))
+        cmd->status = BLK_STS_OK;
+    else if (cmd->ret < 0)
+        cmd->status = errno_to_blk_status(cmd->ret);
+    else
+        cmd->status = BLK_STS_IOERR;
+    
+    // The write-through cache must only ever hold what the file holds,
+    // so it is updated once the write has landed, or the range dropped
+    // if it has not. That sleeps, and this may be the backing device's
+    // completion interrupt, so the worker does it.
+    if (req_op(req) == REQ_OP_WRITE && backing_cache_mb) {
+        cmd->update_cache = true;
+        queue_work(sb->wq, &cmd->work);
+        return;
+    }
+    
+    simple_block_finish_cmd(req);
+}
+
+// kiocb completion for file-backed I/O, from the worker when the call
+// did not queue or from the backing device's completion context
+static void simple_block_aio_complete(struct kiocb *iocb, long ret) {
+    struct simple_block_cmd *cmd = container_of(iocb, struct simple_block_cmd, iocb);
+    
+    cmd->ret = ret;
+    simple_block_aio_put(cmd);
+}
+
+// A merged request spans several bios: flatten their vectors into
+// cmd->bvec for the kiocb. Called from queue_rq before the request is
+// started, so a failed allocation can go back to blk-mq for a retry.
+static int simple_block_map_bvec(struct request *req) {
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
+    struct req_iterator rq_iter;
+    struct bio_vec tmp, *bvec;
+    unsigned int nr_bvec = 0;
+    
+    if (req->bio == req->biotail)
+        return 0;
+    
+    rq_for_each_bvec(tmp, req, rq_iter)
+        nr_bvec++;
+    
+    cmd->bvec = kmalloc_array(nr_bvec, sizeof(*bvec), GFP_NOIO);
+    if (!cmd->bvec)
+        return -ENOMEM;
+    bvec = cmd->bvec;
+    rq_for_each_bvec(tmp, req, rq_iter)
+        *bvec++ = tmp;
+    return 0;
+}
+
+// Submit @req to the backing file as one async kiocb over the request's
+// own pages, O_DIRECT unless the file could not be opened that way. The
+// completion may run before this returns; whichever of the two finishes
+// last completes the request.
+static void simple_block_submit_aio(struct simple_block_dev *sb,
+                                    struct request *req, bool write) {
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
+    struct file *file = sb->backing;
+    struct bio *bio = req->bio;
+    struct req_iterator rq_iter;
+    struct bio_vec tmp, *bvec;
+    struct iov_iter iter;
+    unsigned int nr_bvec = 0, offset;
+    ssize_t ret;
+    
+    rq_for_each_bvec(tmp, req, rq_iter)
+        nr_bvec++;
+    
+    if (cmd->bvec) {
+        bvec = cmd->bvec;
+        offset = 0;
+    } else {
+        // A split bio may start part way into its first bvec
+        bvec = __bvec_iter_bvec(bio->bi_io_vec, bio->bi_iter);
+        offset = bio->bi_iter.bi_bvec_done;
+    }
+    
+    iov_iter_bvec(&iter, write ? ITER_SOURCE : ITER_DEST, bvec, nr_bvec,
+                  blk_rq_bytes(req));
+    iter.iov_offset = offset;
+    
+    cmd->iocb.ki_pos = (loff_t)blk_rq_pos(req) << SECTOR_SHIFT;
+    cmd->iocb.ki_filp = file;
+    cmd->iocb.ki_complete = simple_block_aio_complete;
+    cmd->iocb.ki_flags = (file->f_flags & O_DIRECT) ? IOCB_DIRECT : 0;
+    cmd->iocb.ki_ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+    atomic_set(&cmd->ref, 2);
+    
+    if (write) {
+        cmd->iocb.ki_flags |= IOCB_WRITE;
+        if (req->cmd_flags & REQ_FUA)
+            cmd->iocb.ki_flags |= IOCB_DSYNC;
+        kiocb_start_write(&cmd->iocb);
+        ret = file->f_op->write_iter(&cmd->iocb, &iter);
+    } else {
+        ret = file->f_op->read_iter(&cmd->iocb, &iter);
+    }
+    
+    if (ret != -EIOCBQUEUED)
+        simple_block_aio_complete(&cmd->iocb, ret);
+    simple_block_aio_put(cmd);
+}
+
+// DISCARD punches a hole in the backing file, WRITE_ZEROES with
+// REQ_NOUNMAP zeroes the range in place. The cached copy is dropped
+// only once the file has changed, so a failed request leaves the cache
+// matching the file.
+static blk_status_t simple_block_backing_discard(struct simple_block_dev *sb,
+                                                 struct request *req, loff_t pos,
+                                                 unsigned int bytes) {
+    int mode = FALLOC_FL_KEEP_SIZE;
+    int ret;
+    
+    mode |= (req->cmd_flags & REQ_NOUNMAP) ? FALLOC_FL_ZERO_RANGE : FALLOC_FL_PUNCH_HOLE;
+    ret = vfs_fallocate(sb->backing, mode, pos, bytes);
+    if (ret)
+        return ret == -EOPNOTSUPP ? BLK_STS_NOTSUPP : errno_to_blk_status(ret);
+    
+    simple_block_zero_range(sb, pos, bytes);
+    return BLK_STS_OK;
+}
+
+// Worker for file-backed requests. queue_rq may run with current->bio_list
+// set, so the bios a file system submits from ->read_iter, ->write_iter,
+// fallocate or fsync would only be queued behind the request that waits
+// for them, and its allocations could recurse into I/O on this disk. Run
+// them from the disk's workqueue instead, with memory reclaim kept off
+// the I/O path.
+static void simple_block_backing_work(struct work_struct *work) {
+    struct simple_block_cmd *cmd = container_of(work, struct simple_block_cmd, work);
+    struct request *req = blk_mq_rq_from_pdu(cmd);
+    struct simple_block_dev *sb = req->q->queuedata;
+    loff_t pos = (loff_t)blk_rq_pos(req) << SECTOR_SHIFT;
+    unsigned int bytes = blk_rq_bytes(req);
+    unsigned int noio_flags;
+    blk_status_t status = BLK_STS_OK;
+    
+    noio_flags = memalloc_noio_save();
+    
+    // Second pass of a write, from simple_block_aio_put()
+    if (cmd->update_cache) {
+        cmd->update_cache = false;
+        if (cmd->status == BLK_STS_OK)
+            simple_block_cache_write(sb, req);
+        else
+            simple_block_cache_invalidate(sb, pos, bytes);
+        simple_block_finish_cmd(req);
+        goto out;
+    }
+    
+    switch (req_op(req)) {
+    case REQ_OP_FLUSH:
+        status = simple_block_flush_status(vfs_fsync(sb->backing, 0));
+        this_cpu_inc(sb->stats->flush_ops);
+        break;
+    case REQ_OP_DISCARD:
+    case REQ_OP_WRITE_ZEROES:
+        status = simple_block_backing_discard(sb, req, pos, bytes);
+        this_cpu_inc(sb->stats->discard_ops);
+        break;
+    case REQ_OP_WRITE:
+        // Everything but a cache hit completes from the kiocb callback.
+        // FUA is an O_DSYNC write, so it syncs from this context too.
+        if (req->cmd_flags & REQ_FUA)
+            cmd->flush_bytes = bytes;
+        this_cpu_inc(sb->stats->write_ops);
+        simple_block_submit_aio(sb, req, true);
+        goto out;
+    default:
+        this_cpu_inc(sb->stats->read_ops);
+        if (!simple_block_cache_read(sb, req)) {
+            simple_block_submit_aio(sb, req, false);
+            goto out;
+        }
+        break;
+    }
+    
+    cmd->status = status;
+    simple_block_finish_cmd(req);
+out:
+    memalloc_noio_restore(noio_flags);
+}
+
+// blk-mq request handler, called concurrently from every hardware queue.
+// The tag set is BLK_MQ_F_BLOCKING so page allocation and the stripe
+// locks may sleep; there is no device-wide lock on this path.
+static blk_status_t simple_block_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                          const struct blk_mq_queue_data *bd) {
+    struct simple_block_dev *sb = hctx->queue->queuedata;
+    struct request *req = bd->rq;
+    struct simple_block_cmd *cmd = blk_mq_rq_to_pdu(req);
     struct bio_vec bvec;
     struct req_iterator iter;
     char *buffer;
-    sector_t sector;
-    unsigned int bytes;
-    
-    while ((req = blk_fetch_request(q)) != NULL) {
-        if (req->cmd_type != REQ_TYPE_FS) {
-            printk(KERN_ERR "SimpleBlock: Non-fs request\n");
-            __blk_end_request_all(req, -EIO);
-            continue;
-        }
-        
-        sector = blk_rq_pos(req);
-        bytes = blk_rq_bytes(req);
-        
-        mutex_lock(&device_mutex);
-        
-        if ((sector + bytes / SECTOR_SIZE) > device_sectors) {
-            printk(KERN_ERR "SimpleBlock: Request beyond device limits\n");
-            mutex_unlock(&device_mutex);
-            __blk_end_request_all(req, -EIO);
-            continue;
-        }
-        
-        rq_for_each_segment(bvec, req, iter) {
-            buffer = kmap(bvec.bv_page) + bvec.bv_offset;
-            
-            if (rq_data_dir(req) == READ) {
-                // Read operation
-                memcpy(buffer, device_data + (sector * SECTOR_SIZE) + bvec.bv_offset, bvec.bv_len);
-                read_ops++;
-                printk(KERN_DEBUG "SimpleBlock: Read %u bytes from sector %llu\n",
-                       bvec.bv_len, sector);
-            } else {
-                // Write operation
-                memcpy(device_data + (sector * SECTOR_SIZE) + bvec.bv_offset, buffer, bvec.bv_len);
-                write_ops++;
-                printk(KERN_DEBUG "SimpleBlock: Wrote %u bytes to sector %llu\n",
-                       bvec.bv_len, sector);
+    sector_t sector = blk_rq_pos(req);
+    unsigned int bytes = blk_rq_bytes(req);
+    loff_t pos = (loff_t)sector << SECTOR_SHIFT;
+    bool write = rq_data_dir(req) == WRITE;
+    bool discard = req_op(req) == REQ_OP_DISCARD || req_op(req) == REQ_OP_WRITE_ZEROES;
+    bool fua = req->cmd_flags & REQ_FUA;
+    bool cache = sb->wc_max && !fua && blk_queue_write_cache(hctx->queue);
+    blk_status_t status = BLK_STS_OK;
+    
+    cmd->counted = false;
+    cmd->update_cache = false;
+    cmd->bvec = NULL;
+    cmd->flush_bytes = 0;
+    
+    // File-backed reads and writes: build the kiocb's vector before the
+    // request is started or anything is cached, so a failed allocation
+    // can simply be retried by blk-mq
+    if (sb->backing && (req_op(req) == REQ_OP_READ || req_op(req) == REQ_OP_WRITE) &&
+        simple_block_map_bvec(req))
+        return BLK_STS_RESOURCE;
+    
+    // Emulated queue depth: push back until an in-flight request completes
+    if (READ_ONCE(sb->model.active)) {
+        u64 depth = READ_ONCE(sb->model.queue_depth);
+        
+        while (atomic_inc_return(&sb->model.inflight) > depth && depth) {
+            // Flag the wait before giving the slot back. If a completion
+            // freed a slot without seeing the flag, the count shows it and
+            // we try again rather than wait for a rerun that never comes.
+            atomic_set(&sb->model.waiting, 1);
+            smp_mb__after_atomic();
+            if (atomic_dec_return(&sb->model.inflight) >= depth) {
+                kfree(cmd->bvec);
+                return BLK_STS_DEV_RESOURCE;
             }
-            
-            kunmap(bvec.bv_page);
         }
+        cmd->counted = true;
+    }
+    
+    blk_mq_start_request(req);
+    
+    cmd->start_ns = ktime_get_ns();
+    trace_simple_block_rq_queue(sector, bytes, write);
+    
+    // Flush: the worker fsyncs the backing file, a RAM disk destages its
+    // write-back cache here
+    if (req_op(req) == REQ_OP_FLUSH) {
+        if (sb->backing) {
+            queue_work(sb->wq, &cmd->work);
+            return BLK_STS_OK;
+        }
+        status = simple_block_flush_status(simple_block_wc_flush(sb, &cmd->flush_bytes));
+        this_cpu_inc(sb->stats->flush_ops);
+        goto done;
+    }
+    
+    if (req_op(req) != REQ_OP_READ && req_op(req) != REQ_OP_WRITE && !discard) {
+        printk(KERN_ERR "SimpleBlock: Unsupported request op %d\n", req_op(req));
+        status = BLK_STS_NOTSUPP;
+        goto done;
+    }
+    
+    if ((sector + (bytes >> SECTOR_SHIFT)) > sb->sectors) {
+        printk(KERN_ERR "SimpleBlock: Request beyond device limits\n");
+        status = BLK_STS_IOERR;
+        goto done;
+    }
+    
+    sb_debug(1, "%s %u bytes at sector %llu\n", write ? "Write" : "Read",
+             bytes, (unsigned long long)sector);
+    
+    // File-backed: completes from simple_block_backing_work()
+    if (sb->backing) {
+        queue_work(sb->wq, &cmd->work);
+        return BLK_STS_OK;
+    }
+    
+    // No payload: release or zero the whole range in one pass
+    if (discard) {
+        if (simple_block_zero_range(sb, pos, bytes))
+            status = BLK_STS_RESOURCE;
+        this_cpu_inc(sb->stats->discard_ops);
+        goto done;
+    }
+    
+    if (fua)
+        cmd->flush_bytes = bytes;
+    
+    rq_for_each_segment(bvec, req, iter) {
+        buffer = bvec_kmap_local(&bvec);
         
-        mutex_unlock(&device_mutex);
-        __blk_end_request_all(req, 0);
+        if (!write) {
+            // Read operation
+            if (simple_block_copy_from_dev(sb, buffer, pos, bvec.bv_len)) {
+                kunmap_local(buffer);
+                status = BLK_STS_IOERR;
+                break;
+            }
+            this_cpu_inc(sb->stats->read_ops);
+        } else {
+            // Write operation
+            if (simple_block_copy_to_dev(sb, buffer, pos, bvec.bv_len, cache)) {
+                kunmap_local(buffer);
+                status = BLK_STS_RESOURCE;
+                break;
+            }
+            this_cpu_inc(sb->stats->write_ops);
+        }
+        
+        kunmap_local(buffer);
+        sb_debug(2, "  segment %u bytes at sector %llu\n", bvec.bv_len,
+                 (unsigned long long)(pos >> SECTOR_SHIFT));
+        pos += bvec.bv_len;
     }
+    
+done:
+    cmd->status = status;
+    simple_block_finish_cmd(req);
+    return BLK_STS_OK;
 }
 
+static const struct blk_mq_ops simple_block_mq_ops = {
+    .queue_rq = simple_block_queue_rq,
+    .init_request = simple_block_init_request,
+};
+
 // Block device operations
-static int block_open(struct block_device *bdev, fmode_t mode) {
-    printk(KERN_INFO "SimpleBlock: Device opened by process %d\n", current->pid);
+static int block_open(struct gendisk *disk, blk_mode_t mode) {
+    printk(KERN_INFO "SimpleBlock: %s opened by process %d\n",
+           disk->disk_name, current->pid);
     return 0;
 }
 
-static void block_release(struct gendisk *disk, fmode_t mode) {
-    printk(KERN_INFO "SimpleBlock: Device closed\n");
+static void block_release(struct gendisk *disk) {
+    printk(KERN_INFO "SimpleBlock: %s closed\n", disk->disk_name);
 }
 
-static int block_ioctl(struct block_device *bdev, fmode_t mode,
+static int block_ioctl(struct block_device *bdev, blk_mode_t mode,
                        unsigned int cmd, unsigned long arg) {
+    struct simple_block_dev *sb = bdev->bd_disk->private_data;
+    
+    // Sizes are those of @bdev, which may be a partition
     if (cmd == BLKGETSIZE) {
         // Return size in sectors
-        put_user(device_sectors, (unsigned long *)arg);
+        put_user((unsigned long)bdev_nr_sectors(bdev), (unsigned long *)arg);
         return 0;
     }
     
     if (cmd == BLKGETSIZE64) {
         // Return size in bytes
-    u64 size = (u64)device_sectors * SECTOR_SIZE;
+        u64 size = bdev_nr_bytes(bdev);
         if (copy_to_user((u64 *)arg, &size, sizeof(size)))
             return -EFAULT;
         return 0;
     }
     
+    if (cmd == SIMPLE_BLOCK_GET_LATENCY_HIST) {
+        struct simple_block_latency_hist hist;
+        
+        if (copy_from_user(&hist.op, (u32 *)arg, sizeof(hist.op)))
+            return -EFAULT;
+        if (hist.op > 1)
+            return -EINVAL;
+        
+        hist.nr_buckets = LAT_HIST_BUCKETS;
+        simple_block_get_lat_hist(sb, hist.op, hist.buckets);
+        if (copy_to_user((struct simple_block_latency_hist *)arg, &hist, sizeof(hist)))
+            return -EFAULT;
+        return 0;
+    }
+    
     return -ENOTTY;
 }
 
+// sysfs: /sys/block/simple_blockN/{read,write}_latency_hist, one
+// "<bucket lower bound in ns> <count>" line per bucket
+static ssize_t simple_block_lat_show(struct device *dev, bool write, char *buf) {
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;
+    u64 buckets[LAT_HIST_BUCKETS];
+    int len = 0, i;
+    
+    simple_block_get_lat_hist(sb, write, buckets);
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        len += sysfs_emit_at(buf, len, "%llu %llu\n",
+                             i ? 1ULL << (i - 1) : 0ULL, buckets[i]);
+    return len;
+}
+
+static ssize_t read_latency_hist_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf) {
+    return simple_block_lat_show(dev, false, buf);
+}
+static DEVICE_ATTR_RO(read_latency_hist);
+
+static ssize_t write_latency_hist_show(struct device *dev,
+                                       struct device_attribute *attr, char *buf) {
+    return simple_block_lat_show(dev, true, buf);
+}
+static DEVICE_ATTR_RO(write_latency_hist);
+
+// sysfs: /sys/block/simple_blockN/dedup_stats. Logical pages are slots
+// holding data, physical pages the distinct pages behind them.
+static ssize_t dedup_stats_show(struct device *dev,
+                                struct device_attribute *attr, char *buf) {
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;
+    long logical = atomic_long_read(&sb->nr_pages);
+    long physical = sb->dedup ? atomic_long_read(&sb->nr_phys) : logical;
+    long ratio = physical ? logical * 100 / physical : 100;
+    
+    return sysfs_emit(buf, "enabled %d\nlogical_pages %ld\nphysical_pages %ld\n"
+                      "index_entries %ld\ndedup_ratio %ld.%02ld\n",
+                      sb->dedup, logical, physical, atomic_long_read(&sb->nr_indexed),
+                      ratio / 100, ratio % 100);
+}
+static DEVICE_ATTR_RO(dedup_stats);
+
+// sysfs: /sys/block/simple_blockN/compress_stats. The ratio compares the
+// data stored against the memory the pool actually uses.
+static ssize_t compress_stats_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf) {
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;
+    u64 orig = (u64)atomic_long_read(&sb->nr_pages) << PAGE_SHIFT;
+    u64 used = sb->zpool ? (u64)zs_get_total_pages(sb->zpool) << PAGE_SHIFT : orig;
+    u64 ratio = used ? div64_u64(orig * 100, used) : 100;
+    
+    return sysfs_emit(buf, "algorithm %s\norig_data_size %llu\ncompr_data_size %lld\n"
+                      "mem_used_total %llu\nhuge_pages %ld\ncompression_ratio %llu.%02llu\n",
+                      sb->zpool ? compress : "none", orig,
+                      (long long)atomic64_read(&sb->compr_bytes), used,
+                      atomic_long_read(&sb->huge_pages), ratio / 100, ratio % 100);
+}
+static DEVICE_ATTR_RO(compress_stats);
+
+// sysfs: /sys/block/simple_blockN/same_filled_stats. same_pages counts
+// slots held as a non-zero fill byte; zero-filled pages are holes and
+// only show up in same_writes.
+static ssize_t same_filled_stats_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf) {
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;
+    unsigned long writes = 0;
+    int cpu;
+    
+    for_each_possible_cpu(cpu)
+        writes += READ_ONCE(per_cpu_ptr(sb->stats, cpu)->same_writes);
+    
+    return sysfs_emit(buf, "same_pages %ld\nsame_writes %lu\n",
+                      atomic_long_read(&sb->nr_filled), writes);
+}
+static DEVICE_ATTR_RO(same_filled_stats);
+
+// sysfs: /sys/block/simple_blockN/write_cache_stats. enabled follows
+// queue/write_cache, which can switch a disk to write-through at runtime.
+static ssize_t write_cache_stats_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf) {
+    struct gendisk *disk = dev_to_disk(dev);
+    struct simple_block_dev *sb = disk->private_data;
+    unsigned long flushes = 0;
+    int cpu;
+    
+    for_each_possible_cpu(cpu)
+        flushes += READ_ONCE(per_cpu_ptr(sb->stats, cpu)->flush_ops);
+    
+    return sysfs_emit(buf, "enabled %d\ncapacity_pages %ld\ndirty_pages %ld\n"
+                      "destaged_pages %ld\nflushes %lu\n",
+                      blk_queue_write_cache(disk->queue), sb->wc_max,
+                      atomic_long_read(&sb->wc_nr), atomic_long_read(&sb->wc_destaged),
+                      flushes);
+}
+static DEVICE_ATTR_RO(write_cache_stats);
+
+// sysfs: /sys/block/simple_blockN/write_cache_drop. Any write throws the
+// dirty pages away as a power loss would, to test what survives above.
+static ssize_t write_cache_drop_store(struct device *dev, struct device_attribute *attr,
+                                      const char *buf, size_t count) {
+    struct gendisk *disk = dev_to_disk(dev);
+    
+    printk(KERN_INFO "SimpleBlock: %s: dropped %ld dirty pages\n",
+           disk->disk_name, simple_block_wc_drop(disk->private_data));
+    return count;
+}
+static DEVICE_ATTR_WO(write_cache_drop);
+
+// sysfs: /sys/block/simple_blockN/model_*, one u64 per knob. Writing
+// any knob restarts the token buckets.
+static void simple_block_model_set(struct simple_block_dev *sb, u64 *knob, u64 val) {
+    struct simple_block_model *m = &sb->model;
+    u64 now = ktime_get_ns();
+    
+    spin_lock_irq(&m->lock);
+    WRITE_ONCE(*knob, val);
+    m->bw.tokens = max_t(u64, m->bandwidth_kbps * 1024 / 100, 1);
+    m->bw.last_ns = now;
+    m->ops.tokens = max_t(u64, m->iops / 100, 1);
+    m->ops.last_ns = now;
+    WRITE_ONCE(m->active, m->latency_ns || m->ns_per_kb || m->bandwidth_kbps ||
+                          m->iops || m->queue_depth || m->flush_latency_ns ||
+                          m->flush_ns_per_kb);
+    spin_unlock_irq(&m->lock);
+}
+
+#define SIMPLE_BLOCK_MODEL_ATTR(name)                                           \
+static ssize_t model_##name##_show(struct device *dev,                          \
+                                   struct device_attribute *attr, char *buf) {  \
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;               \
+                                                                                \
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(sb->model.name));                \
+}                                                                               \
+static ssize_t model_##name##_store(struct device *dev,                         \
+                                    struct device_attribute *attr,              \
+                                    const char *buf, size_t count) {            \
+    struct simple_block_dev *sb = dev_to_disk(dev)->private_data;               \
+    u64 val;                                                                    \
+    int ret = kstrtou64(buf, 0, &val);                                          \
+                                                                                \
+    if (ret)                                                                    \
+        return ret;                                                             \
+    simple_block_model_set(sb, &sb->model.name, val);                           \
+    return count;                                                               \
+}                                                                               \
+static DEVICE_ATTR_RW(model_##name)
+
+SIMPLE_BLOCK_MODEL_ATTR(latency_ns);
+SIMPLE_BLOCK_MODEL_ATTR(ns_per_kb);
+SIMPLE_BLOCK_MODEL_ATTR(bandwidth_kbps);
+SIMPLE_BLOCK_MODEL_ATTR(iops);
+SIMPLE_BLOCK_MODEL_ATTR(queue_depth);
+SIMPLE_BLOCK_MODEL_ATTR(flush_latency_ns);
+SIMPLE_BLOCK_MODEL_ATTR(flush_ns_per_kb);
+
+static struct attribute *simple_block_attrs[] = {
+    &dev_attr_read_latency_hist.attr,
+    &dev_attr_write_latency_hist.attr,
+    &dev_attr_dedup_stats.attr,
+    &dev_attr_compress_stats.attr,
+    &dev_attr_same_filled_stats.attr,
+    &dev_attr_write_cache_stats.attr,
+    &dev_attr_write_cache_drop.attr,
+    &dev_attr_model_latency_ns.attr,
+    &dev_attr_model_ns_per_kb.attr,
+    &dev_attr_model_bandwidth_kbps.attr,
+    &dev_attr_model_iops.attr,
+    &dev_attr_model_queue_depth.attr,
+    &dev_attr_model_flush_latency_ns.attr,
+    &dev_attr_model_flush_ns_per_kb.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(simple_block);
+
 static struct block_device_operations block_ops = {
     .owner = THIS_MODULE,
     .open = block_open,
@@ -117,105 +1750,390 @@ static struct block_device_operations block_ops = {
     .ioctl = block_ioctl,
 };
 
-static int __init block_init(void) {
-    printk(KERN_INFO "SimpleBlock: Initializing enhanced driver\n");
+// Open @path as the disk's backing file, O_DIRECT when the file system
+// supports it and our logical blocks are large enough for its device.
+// The capacity follows the file unless device_sectors was given for this
+// disk, in which case a shorter file is extended (sparsely) to fit.
+static int simple_block_open_backing(struct simple_block_dev *sb, const char *path,
+                                     bool sized) {
+    struct super_block *fs_sb;
+    struct file *file;
+    loff_t size, bytes;
+    int ret;
     
-    // Allocate major number
-    major_number = register_blkdev(0, DEVICE_NAME);
-    if (major_number <= 0) {
-        printk(KERN_ERR "SimpleBlock: Failed to register block device\n");
-        return -EBUSY;
+    file = filp_open(path, O_RDWR | O_LARGEFILE | O_DIRECT, 0);
+    if (!IS_ERR(file)) {
+        fs_sb = file_inode(file)->i_sb;
+        if (fs_sb->s_bdev && bdev_logical_block_size(fs_sb->s_bdev) > logical_block_size) {
+            printk(KERN_WARNING "SimpleBlock: %s needs %u-byte blocks for direct I/O\n",
+                   path, bdev_logical_block_size(fs_sb->s_bdev));
+            fput(file);
+            file = ERR_PTR(-EINVAL);
+        }
+    }
+    if (IS_ERR(file) && PTR_ERR(file) == -EINVAL) {
+        printk(KERN_WARNING "SimpleBlock: %s: using buffered I/O\n", path);
+        file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+    }
+    if (IS_ERR(file)) {
+        printk(KERN_ERR "SimpleBlock: Failed to open backing file %s\n", path);
+        return PTR_ERR(file);
     }
     
-    printk(KERN_INFO "SimpleBlock: Registered with major number %d\n", major_number);
+    if (!S_ISREG(file_inode(file)->i_mode)) {
+        printk(KERN_ERR "SimpleBlock: %s is not a regular file\n", path);
+        fput(file);
+        return -EINVAL;
+    }
     
-    // Allocate memory for device data
-    device_data = vmalloc(device_sectors * SECTOR_SIZE);
-    if (!device_data) {
-        printk(KERN_ERR "SimpleBlock: Failed to allocate device memory\n");
-        unregister_blkdev(major_number, DEVICE_NAME);
-        return -ENOMEM;
+    size = i_size_read(file_inode(file));
+    if (!sized && size) {
+        sb->sectors = (size >> SECTOR_SHIFT) & ~((sector_t)(logical_block_size >> SECTOR_SHIFT) - 1);
+    } else {
+        bytes = (loff_t)sb->sectors << SECTOR_SHIFT;
+        if (size < bytes) {
+            ret = vfs_truncate(&file->f_path, bytes);
+            if (ret) {
+                printk(KERN_ERR "SimpleBlock: Failed to extend %s\n", path);
+                fput(file);
+                return ret;
+            }
+        }
     }
-    memset(device_data, 0, device_sectors * SECTOR_SIZE);
     
-    // Initialize with a welcome message
-    const char *welcome_msg = "=== Simple Block Device Storage ===\n"
-                             "Total sectors: %lu\n"
-                             "Total size: %lu KB\n"
-                             "Use this device for block I/O operations\n";
+    sb->backing = file;
+    return 0;
+}
+
+static int simple_block_dev_create(struct simple_block_dev *sb, int index) {
+    struct queue_limits lim = {
+        .logical_block_size = logical_block_size,
+        .physical_block_size = physical_block_size,
+        .io_min = io_min,
+        .io_opt = io_opt,
+        .max_hw_sectors = max_hw_sectors_kb << 1,
+        .max_segments = max_segments,
+        .max_segment_size = max_segment_size,
+        // Discard in page units, since that is what frees memory
+        .max_hw_discard_sectors = UINT_MAX >> SECTOR_SHIFT,
+        .discard_granularity = PAGE_SIZE,
+        .max_write_zeroes_sectors = UINT_MAX >> SECTOR_SHIFT,
+    };
+    struct gendisk *disk;
     char init_msg[512];
-    snprintf(init_msg, sizeof(init_msg), welcome_msg, 
-             device_sectors, (device_sectors * SECTOR_SIZE) / 1024);
-    memcpy(device_data, init_msg, strlen(init_msg));
-    
-    // Create request queue
-    queue = blk_init_queue(simple_block_request, NULL);
-    if (!queue) {
-        printk(KERN_ERR "SimpleBlock: Failed to create request queue\n");
-        vfree(device_data);
-        unregister_blkdev(major_number, DEVICE_NAME);
-        return -ENOMEM;
+    int ret, i;
+    
+    sb->index = index;
+    sb->sectors = device_sectors[min(index, max(nr_device_sectors, 1) - 1)];
+    xa_init(&sb->pages);
+    atomic_long_set(&sb->nr_pages, 0);
+    atomic_long_set(&sb->nr_filled, 0);
+    spin_lock_init(&sb->model.lock);
+    spin_lock_init(&sb->dedup_lock);
+    xa_init(&sb->dedup_index);
+    xa_init(&sb->wc_pages);
+    atomic_long_set(&sb->wc_nr, 0);
+    atomic_long_set(&sb->wc_destaged, 0);
+    atomic_set(&sb->model.inflight, 0);
+    atomic_set(&sb->model.waiting, 0);
+    for (i = 0; i < NR_STRIPES; i++)
+        init_rwsem(&sb->stripes[i].lock);
+    
+    if (index < nr_backing_files && backing_file[index] && *backing_file[index]) {
+        ret = simple_block_open_backing(sb, backing_file[index], index < nr_device_sectors);
+        if (ret)
+            return ret;
+        
+        sb->wq = alloc_workqueue(DEVICE_NAME "%d", WQ_UNBOUND | WQ_FREEZABLE, 0, index);
+        if (!sb->wq) {
+            ret = -ENOMEM;
+            goto out_put_backing;
+        }
+    }
+    
+    // The write-through cache updates pages in place, so a file-backed
+    // disk never dedups or compresses
+    sb->dedup = dedup && !sb->backing;
+    sb->wc_max = sb->backing ? 0 : (long)write_cache_mb << (20 - PAGE_SHIFT);
+    
+    // A backing file is flushed with fsync; a RAM disk only has something
+    // to flush with the write-back cache
+    if (sb->backing || sb->wc_max)
+        lim.features |= BLK_FEAT_WRITE_CACHE | BLK_FEAT_FUA;
+    
+    if (!sb->sectors) {
+        printk(KERN_ERR "SimpleBlock: device_sectors for disk %d must be non-zero\n", index);
+        ret = -EINVAL;
+        goto out_put_backing;
+    }
+    
+    if (sb->sectors & ((logical_block_size >> SECTOR_SHIFT) - 1)) {
+        printk(KERN_ERR "SimpleBlock: device_sectors for disk %d is not a multiple of %u-byte blocks\n",
+               index, logical_block_size);
+        ret = -EINVAL;
+        goto out_put_backing;
+    }
+    
+    sb->stats = alloc_percpu(struct simple_block_stats);
+    if (!sb->stats) {
+        ret = -ENOMEM;
+        goto out_put_backing;
+    }
+    
+    if (zstrms && !sb->backing) {
+        snprintf(init_msg, sizeof(init_msg), DEVICE_NAME "%d", index);
+        sb->zpool = zs_create_pool(init_msg);
+        if (!sb->zpool) {
+            ret = -ENOMEM;
+            goto out_free_data;
+        }
     }
     
-    // Set queue parameters
-    blk_queue_logical_block_size(queue, SECTOR_SIZE);
-    blk_queue_physical_block_size(queue, SECTOR_SIZE);
-    queue->queuedata = device_data;
+    // Initialize a RAM disk with a welcome message; a backing file
+    // already holds the disk's contents
+    if (!sb->backing) {
+        snprintf(init_msg, sizeof(init_msg),
+                 "=== Simple Block Device Storage ===\n"
+                 "Disk: %s%d\n"
+                 "Total sectors: %llu\n"
+                 "Total size: %llu KB\n"
+                 "Use this device for block I/O operations\n",
+                 DEVICE_NAME, index, (unsigned long long)sb->sectors,
+                 (unsigned long long)(sb->sectors * SECTOR_SIZE) / 1024);
+        ret = simple_block_copy_to_dev(sb, init_msg, 0, strlen(init_msg), false);
+        if (ret) {
+            printk(KERN_ERR "SimpleBlock: Failed to allocate device memory\n");
+            goto out_free_data;
+        }
+    }
+    
+    // Create the blk-mq tag set, one hardware queue per CPU by default
+    sb->tag_set.ops = &simple_block_mq_ops;
+    sb->tag_set.nr_hw_queues = hw_queues ? hw_queues : num_online_cpus();
+    sb->tag_set.queue_depth = queue_depth ? queue_depth : DEFAULT_QUEUE_DEPTH;
+    sb->tag_set.numa_node = NUMA_NO_NODE;
+    sb->tag_set.flags = BLK_MQ_F_BLOCKING;
+    sb->tag_set.cmd_size = sizeof(struct simple_block_cmd);
+    
+    ret = blk_mq_alloc_tag_set(&sb->tag_set);
+    if (ret) {
+        printk(KERN_ERR "SimpleBlock: Failed to allocate tag set\n");
+        goto out_free_data;
+    }
     
-    // Create gendisk structure
-    simple_disk = alloc_disk(1);
-    if (!simple_disk) {
+    // Create gendisk structure together with its request queue
+    disk = blk_mq_alloc_disk(&sb->tag_set, &lim, sb);
+    if (IS_ERR(disk)) {
         printk(KERN_ERR "SimpleBlock: Failed to allocate disk structure\n");
-        blk_cleanup_queue(queue);
-        vfree(device_data);
-        unregister_blkdev(major_number, DEVICE_NAME);
-        return -ENOMEM;
+        ret = PTR_ERR(disk);
+        goto out_free_tag_set;
     }
     
     // Set up the disk
-    simple_disk->major = major_number;
-    simple_disk->first_minor = 0;
-    simple_disk->fops = &block_ops;
-    simple_disk->queue = queue;
-    simple_disk->private_data = device_data;
-    snprintf(simple_disk->disk_name, DISK_NAME_LEN, DEVICE_NAME);
-    set_capacity(simple_disk, device_sectors);
+    disk->major = major_number;
+    disk->first_minor = index * part_minors;
+    disk->minors = part_minors;
+    disk->fops = &block_ops;
+    disk->private_data = sb;
+    snprintf(disk->disk_name, DISK_NAME_LEN, DEVICE_NAME "%d", index);
+    set_capacity(disk, sb->sectors);
     
     // Add disk to the system
-    add_disk(simple_disk);
+    ret = device_add_disk(NULL, disk, simple_block_groups);
+    if (ret) {
+        printk(KERN_ERR "SimpleBlock: Failed to add disk %d\n", index);
+        goto out_put_disk;
+    }
+    sb->disk = disk;
     
-    mutex_init(&device_mutex);
+    printk(KERN_INFO "SimpleBlock: /dev/%s: %llu sectors (%llu KB), %s\n",
+           disk->disk_name, (unsigned long long)sb->sectors,
+           (unsigned long long)(sb->sectors * SECTOR_SIZE) / 1024,
+           sb->backing ? "file-backed" : sb->zpool ? "sparse, compressed" :
+           sb->dedup ? "sparse, dedup" : "sparse");
     
-    printk(KERN_INFO "SimpleBlock: Driver initialized successfully\n");
-    printk(KERN_INFO "SimpleBlock: Device size: %lu sectors (%lu KB)\n",
-           device_sectors, (device_sectors * SECTOR_SIZE) / 1024);
-    printk(KERN_INFO "SimpleBlock: Device node: /dev/%s\n", DEVICE_NAME);
+    return 0;
+    
+out_put_disk:
+    put_disk(disk);
+out_free_tag_set:
+    blk_mq_free_tag_set(&sb->tag_set);
+out_free_data:
+    simple_block_free_pages(sb);
+    free_percpu(sb->stats);
+out_put_backing:
+    if (sb->wq)
+        destroy_workqueue(sb->wq);
+    if (sb->backing)
+        fput(sb->backing);
+    return ret;
+}
+
+static void simple_block_dev_destroy(struct simple_block_dev *sb) {
+    unsigned long reads, writes, discards;
+    
+    del_gendisk(sb->disk);
+    put_disk(sb->disk);
+    blk_mq_free_tag_set(&sb->tag_set);
+    if (sb->wq)
+        destroy_workqueue(sb->wq);
+    
+    simple_block_get_stats(sb, &reads, &writes, &discards);
+    printk(KERN_INFO "SimpleBlock: %s%d total reads: %lu, writes: %lu, discards: %lu, pages used: %ld\n",
+           DEVICE_NAME, sb->index, reads, writes, discards,
+           sb->dedup ? atomic_long_read(&sb->nr_phys) : atomic_long_read(&sb->nr_pages));
+    
+    simple_block_free_pages(sb);
+    free_percpu(sb->stats);
     
+    // O_DIRECT writes have reached the file; make its metadata durable too
+    if (sb->backing) {
+        vfs_fsync(sb->backing, 0);
+        fput(sb->backing);
+    }
+}
+
+static void simple_block_free_streams(void) {
+    int cpu;
+    
+    if (!zstrms)
+        return;
+    for_each_possible_cpu(cpu) {
+        struct simple_block_zstrm *zs = per_cpu_ptr(zstrms, cpu);
+        
+        if (!IS_ERR_OR_NULL(zs->tfm))
+            crypto_free_comp(zs->tfm);
+        kfree(zs->buffer);
+        kfree(zs->page);
+    }
+    free_percpu(zstrms);
+    zstrms = NULL;
+}
+
+// One compression stream per possible CPU, so compressing a page never
+// waits for another CPU
+static int simple_block_alloc_streams(const char *alg) {
+    int cpu, ret;
+    
+    zstrms = alloc_percpu(struct simple_block_zstrm);
+    if (!zstrms)
+        return -ENOMEM;
+    
+    for_each_possible_cpu(cpu) {
+        struct simple_block_zstrm *zs = per_cpu_ptr(zstrms, cpu);
+        
+        local_lock_init(&zs->lock);
+        zs->tfm = crypto_alloc_comp(alg, 0, 0);
+        zs->buffer = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+        zs->page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+        if (IS_ERR(zs->tfm) || !zs->buffer || !zs->page) {
+            ret = IS_ERR(zs->tfm) ? PTR_ERR(zs->tfm) : -ENOMEM;
+            simple_block_free_streams();
+            return ret;
+        }
+    }
     return 0;
 }
 
-static void __exit block_exit(void) {
-    if (simple_disk) {
-        del_gendisk(simple_disk);
-        put_disk(simple_disk);
+static int __init block_init(void) {
+    int ret, i;
+    
+    printk(KERN_INFO "SimpleBlock: Initializing enhanced driver\n");
+    
+    if (num_disks < 1 || num_disks > MAX_DISKS) {
+        printk(KERN_ERR "SimpleBlock: num_disks must be 1..%d\n", MAX_DISKS);
+        return -EINVAL;
     }
     
-    if (queue) {
-        blk_cleanup_queue(queue);
+    if (part_minors < 1 || part_minors > DISK_MAX_PARTS) {
+        printk(KERN_ERR "SimpleBlock: part_minors must be 1..%d\n", DISK_MAX_PARTS);
+        return -EINVAL;
     }
     
-    if (device_data) {
-        vfree(device_data);
+    // The remaining limits are checked by the block layer when the
+    // first disk is allocated
+    if (blk_validate_block_size(logical_block_size)) {
+        printk(KERN_ERR "SimpleBlock: logical_block_size must be a power of two from 512 to %lu\n",
+               PAGE_SIZE);
+        return -EINVAL;
+    }
+    if (!physical_block_size)
+        physical_block_size = logical_block_size;
+    if (!is_power_of_2(physical_block_size) || physical_block_size < logical_block_size) {
+        printk(KERN_ERR "SimpleBlock: physical_block_size must be a power of two >= logical_block_size\n");
+        return -EINVAL;
     }
     
-    if (major_number) {
-        unregister_blkdev(major_number, DEVICE_NAME);
+    if (compress && *compress) {
+        if (dedup) {
+            printk(KERN_ERR "SimpleBlock: dedup and compress cannot be combined\n");
+            return -EINVAL;
+        }
+        ret = simple_block_alloc_streams(compress);
+        if (ret) {
+            printk(KERN_ERR "SimpleBlock: Compression algorithm %s unavailable\n", compress);
+            return ret;
+        }
     }
     
-    mutex_destroy(&device_mutex);
+    // Allocate major number
+    major_number = register_blkdev(0, DEVICE_NAME);
+    if (major_number <= 0) {
+        printk(KERN_ERR "SimpleBlock: Failed to register block device\n");
+        simple_block_free_streams();
+        return -EBUSY;
+    }
+    
+    printk(KERN_INFO "SimpleBlock: Registered with major number %d\n", major_number);
+    
+    sb_devs = kcalloc(num_disks, sizeof(*sb_devs), GFP_KERNEL);
+    if (!sb_devs) {
+        ret = -ENOMEM;
+        goto out_unregister;
+    }
+    
+    // Create disks
+    for (i = 0; i < num_disks; i++) {
+        ret = simple_block_dev_create(&sb_devs[i], i);
+        if (ret) {
+            while (i--)
+                simple_block_dev_destroy(&sb_devs[i]);
+            goto out_free_devs;
+        }
+    }
+    
+    printk(KERN_INFO "SimpleBlock: Driver initialized successfully\n");
+    printk(KERN_INFO "SimpleBlock: %u disk(s), %u minor(s) each\n",
+           num_disks, part_minors);
+    printk(KERN_INFO "SimpleBlock: Hardware queues: %u, depth: %u per disk\n",
+           sb_devs[0].tag_set.nr_hw_queues, sb_devs[0].tag_set.queue_depth);
+    printk(KERN_INFO "SimpleBlock: Block size: %u logical, %u physical, max request %u KB\n",
+           logical_block_size, physical_block_size,
+           queue_max_hw_sectors(sb_devs[0].disk->queue) >> 1);
+    if (zstrms)
+        printk(KERN_INFO "SimpleBlock: Compressing RAM disk pages with %s\n", compress);
+    
+    return 0;
+    
+out_free_devs:
+    kfree(sb_devs);
+out_unregister:
+    unregister_blkdev(major_number, DEVICE_NAME);
+    major_number = 0;
+    simple_block_free_streams();
+    return ret;
+}
+
+static void __exit block_exit(void) {
+    int i;
+    
+    for (i = 0; i < num_disks; i++)
+        simple_block_dev_destroy(&sb_devs[i]);
+    kfree(sb_devs);
+    simple_block_free_streams();
     
+    unregister_blkdev(major_number, DEVICE_NAME);
     printk(KERN_INFO "SimpleBlock: Driver removed\n");
-    printk(KERN_INFO "SimpleBlock: Total reads: %lu, writes: %lu\n", read_ops, write_ops);
 }
 
 module_init(block_init);
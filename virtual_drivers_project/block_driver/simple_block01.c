@@ -49,13 +49,9 @@ static void simple_block_request(struct request_queue *q) {
             if (rq_data_dir(req) == READ) {
                 // Read operation
                 memcpy(buffer, device_data + (sector * SECTOR_SIZE) + bvec.bv_offset, bvec.bv_len);
-                printk(KERN_INFO "SimpleBlock: Read %u bytes from sector %llu\n",
-                       bvec.bv_len, sector);
             } else {
                 // Write operation
                 memcpy(device_data + (sector * SECTOR_SIZE) + bvec.bv_offset, buffer, bvec.bv_len);
-                printk(KERN_INFO "SimpleBlock: Wrote %u bytes to sector %llu\n",
-                       bvec.bv_len, sector);
             }
         }
         
@@ -0,0 +1,68 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM simple_block
+
+#if !defined(_SIMPLE_BLOCK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SIMPLE_BLOCK_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+// Tracepoints for the simple_block I/O path. They compile to a patched-out
+// branch until enabled, e.g.:
+//   echo 1 > /sys/kernel/tracing/events/simple_block/enable
+
+TRACE_EVENT(simple_block_rq_queue,
+    TP_PROTO(sector_t sector, unsigned int bytes, bool write),
+    TP_ARGS(sector, bytes, write),
+
+    TP_STRUCT__entry(
+        __field(sector_t, sector)
+        __field(unsigned int, bytes)
+        __field(bool, write)
+    ),
+
+    TP_fast_assign(
+        __entry->sector = sector;
+        __entry->bytes = bytes;
+        __entry->write = write;
+    ),
+
+    TP_printk("%s sector=%llu bytes=%u",
+              __entry->write ? "write" : "read",
+              (unsigned long long)__entry->sector, __entry->bytes)
+);
+
+TRACE_EVENT(simple_block_rq_complete,
+    TP_PROTO(sector_t sector, unsigned int bytes, bool write,
+             int error, u64 latency_ns),
+    TP_ARGS(sector, bytes, write, error, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(sector_t, sector)
+        __field(unsigned int, bytes)
+        __field(bool, write)
+        __field(int, error)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->sector = sector;
+        __entry->bytes = bytes;
+        __entry->write = write;
+        __entry->error = error;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("%s sector=%llu bytes=%u error=%d latency_ns=%llu",
+              __entry->write ? "write" : "read",
+              (unsigned long long)__entry->sector, __entry->bytes,
+              __entry->error, (unsigned long long)__entry->latency_ns)
+);
+
+#endif /* _SIMPLE_BLOCK_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE simple_block_trace
+#include <trace/define_trace.h>
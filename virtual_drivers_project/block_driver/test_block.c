@@ -3,13 +3,70 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 
-#define DEVICE_PATH "/dev/simple_block"
+#define DEVICE_PATH "/dev/simple_block0"
 #define BLOCK_SIZE 512
 #define BUFFER_SIZE 1024
 
+// Discard/zero-out test area, clear of the data at the start of the disk
+#define DISCARD_BASE (64 * 1024)
+#define DISCARD_LEN (64 * 1024)
+
+// Write a pattern, BLKDISCARD whole pages in the middle of it and
+// BLKZEROOUT a range that starts and ends part way into pages, then check
+// both ranges read back as zeros and everything around them is intact
+static int test_discard(int fd) {
+    const char *test = "Discard/zero-out";
+    static unsigned char expected[DISCARD_LEN], actual[DISCARD_LEN];
+    uint64_t discard[2] = { DISCARD_BASE + 8192, 16384 };
+    uint64_t zeroout[2] = { DISCARD_BASE + 40960 + BLOCK_SIZE, 4096 };
+    uint64_t size = 0;
+    int i;
+    
+    if (ioctl(fd, BLKGETSIZE64, &size) < 0 || size < DISCARD_BASE + DISCARD_LEN) {
+        printf("%s: device too small, skipped\n", test);
+        return 0;
+    }
+    
+    for (i = 0; i < DISCARD_LEN; i++)
+        expected[i] = (i * 7 + 1) & 0xff;
+    
+    // Make the pattern reach the driver before the ioctls drop the range
+    if (pwrite(fd, expected, DISCARD_LEN, DISCARD_BASE) != DISCARD_LEN || fsync(fd) < 0) {
+        printf("%s: writing the pattern failed\n", test);
+        return -1;
+    }
+    
+    if (ioctl(fd, BLKDISCARD, discard) < 0) {
+        perror("BLKDISCARD");
+        return -1;
+    }
+    if (ioctl(fd, BLKZEROOUT, zeroout) < 0) {
+        perror("BLKZEROOUT");
+        return -1;
+    }
+    memset(expected + discard[0] - DISCARD_BASE, 0, discard[1]);
+    memset(expected + zeroout[0] - DISCARD_BASE, 0, zeroout[1]);
+    
+    if (pread(fd, actual, DISCARD_LEN, DISCARD_BASE) != DISCARD_LEN) {
+        printf("%s: reading back failed\n", test);
+        return -1;
+    }
+    for (i = 0; i < DISCARD_LEN; i++) {
+        if (actual[i] != expected[i]) {
+            printf("%s: byte at %d is 0x%02x, expected 0x%02x\n", test,
+                   DISCARD_BASE + i, actual[i], expected[i]);
+            return -1;
+        }
+    }
+    
+    printf("%s: OK\n", test);
+    return 0;
+}
+
 int main() {
     int fd;
     char write_buffer[BUFFER_SIZE];
@@ -56,6 +113,11 @@ int main() {
     read_buffer[bytes_read] = '\0';
     printf("Read %ld bytes from block device:\n%s\n", bytes_read, read_buffer);
     
+    if (test_discard(fd) < 0) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    
     // Close device
     close(fd);
     printf("Block device closed\n");
@@ -7,7 +7,7 @@
 #include <termios.h>
 #include <ctype.h>
 
-#define DEVICE_PATH "/dev/simple_char"
+#define DEVICE_PATH "/dev/simple_char0"
 #define BUFFER_SIZE 4096
 #define MAX_INPUT 256
 
@@ -302,7 +302,7 @@ int main() {
         perror("Failed to open device");
         printf("Make sure the driver is loaded and device node exists:\n");
         printf("sudo insmod simple_char.ko\n");
-        printf("sudo mknod /dev/simple_char c 240 0\n");
+        printf("sudo mknod /dev/simple_char0 c 240 0\n");
         return EXIT_FAILURE;
     }
     
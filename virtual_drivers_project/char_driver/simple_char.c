@@ -4,12 +4,32 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/slab.h>
-#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/xarray.h>
+#include <linux/rwsem.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/log2.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/io_uring/cmd.h>
+
+#define CREATE_TRACE_POINTS
+#include "simple_char_trace.h"
 
 #define DEVICE_NAME "simple_char"
 #define CLASS_NAME "simple_char_class"
 #define BUFFER_SIZE 4096
+#define DEFAULT_MAX_BUFFER_MB 1024
+#define FIFO_MAX_SIZE (16 * 1024 * 1024)
 
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("Simple Character Device Driver with Enhanced Features");
@@ -18,15 +38,151 @@ MODULE_VERSION("2.0");
 
 static int major_number;
 static struct class* char_class = NULL;
-static struct device* char_device = NULL;
-static struct cdev char_cdev;
-static DEFINE_MUTEX(device_mutex);
 
-static char *device_buffer = NULL;
-static int buffer_size = BUFFER_SIZE;
-static int buffer_offset = 0;
-static int read_count = 0;
-static int write_count = 0;
+#define MAX_DEVICES 64
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of /dev/simple_charN devices (default: 1, max: 64)");
+
+// Per-CPU operation and byte counters, summed only when reported so
+// stats polling never touches the data path locks
+struct char_pcpu_stats {
+    u64_stats_t read_ops;
+    u64_stats_t write_ops;
+    u64_stats_t read_bytes;
+    u64_stats_t write_bytes;
+    struct u64_stats_sync syncp;
+};
+
+// Per-CPU log2 latency histograms, merged when reported. Bucket 0 counts
+// 0 ns; bucket i counts [2^(i-1), 2^i) ns; the last bucket also takes
+// everything slower.
+#define LAT_HIST_BUCKETS 32
+
+enum {
+    CHAR_LAT_READ,
+    CHAR_LAT_WRITE,
+    CHAR_LAT_IOCTL,
+    CHAR_LAT_NR,
+};
+
+struct char_lat_hist {
+    unsigned long buckets[CHAR_LAT_NR][LAT_HIST_BUCKETS];
+};
+
+// Mapped read-only for holes, see dev_vm_fault(). The kernel's ZERO_PAGE
+// may not be inserted into shared mappings that can become writable.
+static struct page *char_zero_page;
+
+static unsigned long max_buffer_mb = DEFAULT_MAX_BUFFER_MB;
+module_param(max_buffer_mb, ulong, 0644);
+MODULE_PARM_DESC(max_buffer_mb, "Maximum buffer size in MB per device (default: 1024)");
+
+// FIFO mode: a single-producer/single-consumer ring buffer. Only the
+// producer advances head and only the consumer advances tail; each side
+// publishes its index with a release store and reads the other side's
+// with an acquire load, so data moves without taking any lock. Indices
+// run freely and are masked with size - 1 on access.
+struct char_fifo {
+    char *data;
+    unsigned int size;                              // Power of two
+    unsigned int head ____cacheline_aligned_in_smp; // Producer index
+    unsigned int tail ____cacheline_aligned_in_smp; // Consumer index
+    struct file *reader;                            // Role owners, set
+    struct file *writer;                            // under rwsem
+};
+
+#define FIFO_ROLE_READER 0x1
+#define FIFO_ROLE_WRITER 0x2
+
+// Per-device state. Each /dev/simple_charN has its own buffer, locks,
+// wait queues and statistics, so separate devices share nothing on the
+// data path.
+struct char_dev {
+    struct cdev cdev;
+    struct device *device;
+    int index;
+    
+    // Held shared by reads and exclusive by anything that changes the buffer
+    struct rw_semaphore rwsem;
+    
+    // Backing store: an xarray of pages indexed by page number. Pages are
+    // allocated on first write (or mmap write fault) and never move, so growing
+    // the buffer is O(1) per page and never copies existing data. Pages
+    // inside buffer_size that were never written read back as zeros.
+    struct xarray pages;
+    loff_t buffer_size;         // Capacity
+    loff_t buffer_offset;       // End of written data
+    
+    // mmap support. Store pages are inserted directly into user mappings.
+    // Every open file shares the address_space of the first opener's
+    // inode, so a shrink or reset can zap all mappings at once. map_rwsem
+    // is held for write while pages are removed and for read by the fault
+    // handler; it is separate from rwsem because copy_to_user() under
+    // rwsem may itself fault on a mapping.
+    struct rw_semaphore map_rwsem;
+    struct inode *inode;
+    int open_count;
+    
+    // Set once a read fault has mapped a hole as char_zero_page; from
+    // then on, filling a hole zaps whatever maps it
+    bool zero_mapped;
+    
+    // Non-NULL while the device is in FIFO mode. It cannot be replaced
+    // while any file holds a role, so role owners may use it without
+    // locking.
+    struct char_fifo *fifo;
+    
+    // Readers waiting for data and writers waiting for FIFO space. These
+    // live here rather than in struct char_fifo so poll() registrations
+    // stay valid across mode switches.
+    wait_queue_head_t read_wait;
+    wait_queue_head_t write_wait;
+    
+    struct char_pcpu_stats __percpu *stats;
+    struct char_lat_hist __percpu *lat;
+};
+
+static struct char_dev *char_devs;
+
+// Per-open state
+struct char_file {
+    struct char_dev *cd;
+    unsigned int fifo_roles;
+    bool blocking;      // read() at end of data sleeps instead of returning 0
+};
+
+// Per-call debug logging, gated by a static key so it costs nothing while
+// debug_level is 0. The simple_char tracepoints are the preferred way to
+// watch individual reads and writes.
+static DEFINE_STATIC_KEY_FALSE(debug_enabled);
+static unsigned int debug_level = 0;
+
+static int debug_level_set(const char *val, const struct kernel_param *kp) {
+    int ret = param_set_uint(val, kp);
+    
+    if (ret)
+        return ret;
+    if (debug_level)
+        static_branch_enable(&debug_enabled);
+    else
+        static_branch_disable(&debug_enabled);
+    return 0;
+}
+
+static const struct kernel_param_ops debug_level_ops = {
+    .set = debug_level_set,
+    .get = param_get_uint,
+};
+module_param_cb(debug_level, &debug_level_ops, &debug_level, 0644);
+MODULE_PARM_DESC(debug_level, "Debug log level: 0=off, 1=reads/writes");
+
+#define sc_debug(level, fmt, ...)                                           \
+    do {                                                                    \
+        if (static_branch_unlikely(&debug_enabled) && debug_level >= (level)) \
+            printk(KERN_DEBUG "SimpleChar: " fmt, ##__VA_ARGS__);           \
+    } while (0)
 
 // IOCTL definitions
 #define CHAR_IOCTL_MAGIC 'C'
@@ -34,6 +190,20 @@ static int write_count = 0;
 #define CHAR_RESET_BUFFER _IO(CHAR_IOCTL_MAGIC, 2)
 #define CHAR_GET_STATS _IOR(CHAR_IOCTL_MAGIC, 3, struct char_stats)
 #define CHAR_SET_BUFFER_SIZE _IOW(CHAR_IOCTL_MAGIC, 4, int)
+// Ring size in bytes (power of two, PAGE_SIZE..16MB), 0 leaves FIFO mode
+#define CHAR_SET_FIFO_MODE _IOW(CHAR_IOCTL_MAGIC, 5, int)
+// Non-zero makes read() at the end of the buffer wait for new data
+#define CHAR_SET_BLOCKING _IOW(CHAR_IOCTL_MAGIC, 6, int)
+// 64-bit variants of CHAR_GET_SIZE/CHAR_SET_BUFFER_SIZE
+#define CHAR_GET_SIZE64 _IOR(CHAR_IOCTL_MAGIC, 7, __u64)
+#define CHAR_SET_BUFFER_SIZE64 _IOW(CHAR_IOCTL_MAGIC, 8, __u64)
+
+// Extended statistics. The driver fills in version and size; new fields
+// are only ever appended, with the version bumped.
+#define CHAR_GET_STATS_EXT _IOR(CHAR_IOCTL_MAGIC, 9, struct char_stats_ext)
+#define CHAR_STATS_EXT_VERSION 1
+// Latency histogram for one operation type (op: 0 read, 1 write, 2 ioctl)
+#define CHAR_GET_LATENCY_HIST _IOWR(CHAR_IOCTL_MAGIC, 10, struct char_latency_hist)
 
 struct char_stats {
     int read_count;
@@ -42,151 +212,1081 @@ struct char_stats {
     int buffer_size;
 };
 
+struct char_stats_ext {
+    __u32 version;
+    __u32 size;
+    __u64 read_ops;
+    __u64 write_ops;
+    __u64 read_bytes;
+    __u64 write_bytes;
+    __u64 buffer_used;
+    __u64 buffer_size;
+};
+
+// Batched submission: execute up to CHAR_BATCH_MAX read/write/seek ops
+// under one lock acquisition. An op with offset < 0 uses (and advances)
+// the file position. Each op's result (bytes or -errno) is written back;
+// the ioctl returns the number of ops run and stops at the first error.
+#define CHAR_SUBMIT_BATCH _IOW(CHAR_IOCTL_MAGIC, 11, struct char_batch)
+#define CHAR_BATCH_MAX 256
+
+enum {
+    CHAR_BATCH_READ,
+    CHAR_BATCH_WRITE,
+    CHAR_BATCH_SEEK,        // Set the file position to offset
+};
+
+struct char_batch_op {
+    __u32 op;
+    __u32 reserved;
+    __s64 offset;
+    __u64 buf;              // User pointer
+    __u64 len;
+    __s64 result;           // Out
+};
+
+struct char_batch {
+    __u64 ops;              // User pointer to struct char_batch_op[nr_ops]
+    __u32 nr_ops;
+    __u32 flags;            // Must be zero
+};
+
+// io_uring passthrough: IORING_OP_URING_CMD with cmd_op set to any
+// CHAR_* ioctl number runs that ioctl; the SQE command area holds the
+// argument the ioctl would take. The CQE result is the ioctl's return.
+struct char_uring_cmd {
+    __u64 arg;
+};
+
+struct char_latency_hist {
+    __u32 op;               // In
+    __u32 nr_buckets;       // Out: LAT_HIST_BUCKETS
+    __u64 buckets[LAT_HIST_BUCKETS];
+};
+
 // Function prototypes
 static int dev_open(struct inode*, struct file*);
 static int dev_release(struct inode*, struct file*);
-static ssize_t dev_read(struct file*, char*, size_t, loff_t*);
-static ssize_t dev_write(struct file*, const char*, size_t, loff_t*);
+static ssize_t dev_read_iter(struct kiocb*, struct iov_iter*);
+static ssize_t dev_write_iter(struct kiocb*, struct iov_iter*);
 static long dev_ioctl(struct file*, unsigned int, unsigned long);
 static loff_t dev_llseek(struct file*, loff_t, int);
+static int dev_mmap(struct file*, struct vm_area_struct*);
+static __poll_t dev_poll(struct file*, poll_table*);
+static int dev_uring_cmd(struct io_uring_cmd*, unsigned int);
+static ssize_t dev_splice_read(struct file*, loff_t*, struct pipe_inode_info*, size_t, unsigned int);
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = dev_open,
-    .read = dev_read,
-    .write = dev_write,
+    .read_iter = dev_read_iter,
+    .write_iter = dev_write_iter,
     .release = dev_release,
     .unlocked_ioctl = dev_ioctl,
     .llseek = dev_llseek,
+    .mmap = dev_mmap,
+    .poll = dev_poll,
+    .uring_cmd = dev_uring_cmd,
+    .splice_read = dev_splice_read,
+    .splice_write = iter_file_splice_write,
 };
 
+static void char_lat_record(struct char_dev *cd, unsigned int op, u64 ns) {
+    this_cpu_inc(cd->lat->buckets[op][min(fls64(ns), LAT_HIST_BUCKETS - 1)]);
+}
+
+static void char_lat_get(struct char_dev *cd, unsigned int op, u64 *buckets) {
+    int cpu, i;
+    
+    memset(buckets, 0, sizeof(u64) * LAT_HIST_BUCKETS);
+    for_each_possible_cpu(cpu) {
+        struct char_lat_hist *hist = per_cpu_ptr(cd->lat, cpu);
+        
+        for (i = 0; i < LAT_HIST_BUCKETS; i++)
+            buckets[i] += READ_ONCE(hist->buckets[op][i]);
+    }
+}
+
+// Count a completed read or write started at @start_ns; returns its
+// latency so the caller can hand it to the tracepoint
+static u64 char_account(struct char_dev *cd, bool write, size_t bytes, u64 start_ns) {
+    u64 latency_ns = ktime_get_ns() - start_ns;
+    struct char_pcpu_stats *stats = get_cpu_ptr(cd->stats);
+    
+    u64_stats_update_begin(&stats->syncp);
+    if (write) {
+        u64_stats_inc(&stats->write_ops);
+        u64_stats_add(&stats->write_bytes, bytes);
+    } else {
+        u64_stats_inc(&stats->read_ops);
+        u64_stats_add(&stats->read_bytes, bytes);
+    }
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(cd->stats);
+    
+    char_lat_record(cd, write ? CHAR_LAT_WRITE : CHAR_LAT_READ, latency_ns);
+    return latency_ns;
+}
+
+static void char_get_stats(struct char_dev *cd, struct char_stats_ext *ext) {
+    int cpu;
+    
+    memset(ext, 0, sizeof(*ext));
+    ext->version = CHAR_STATS_EXT_VERSION;
+    ext->size = sizeof(*ext);
+    
+    for_each_possible_cpu(cpu) {
+        struct char_pcpu_stats *stats = per_cpu_ptr(cd->stats, cpu);
+        u64 rops, wops, rbytes, wbytes;
+        unsigned int start;
+        
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            rops = u64_stats_read(&stats->read_ops);
+            wops = u64_stats_read(&stats->write_ops);
+            rbytes = u64_stats_read(&stats->read_bytes);
+            wbytes = u64_stats_read(&stats->write_bytes);
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+        
+        ext->read_ops += rops;
+        ext->write_ops += wops;
+        ext->read_bytes += rbytes;
+        ext->write_bytes += wbytes;
+    }
+    
+    ext->buffer_used = READ_ONCE(cd->buffer_offset);
+    ext->buffer_size = READ_ONCE(cd->buffer_size);
+}
+
 static int dev_open(struct inode *inodep, struct file *filep) {
-    printk(KERN_INFO "SimpleChar: Device opened by process %d\n", current->pid);
+    struct char_dev *cd = container_of(inodep->i_cdev, struct char_dev, cdev);
+    struct char_file *ctx;
+    
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+    ctx->cd = cd;
+    filep->private_data = ctx;
+    
+    // read_iter/write_iter honour IOCB_NOWAIT, so io_uring may issue
+    // them inline and RWF_NOWAIT is accepted
+    filep->f_mode |= FMODE_NOWAIT;
+    
+    down_write(&cd->rwsem);
+    if (cd->open_count++ == 0) {
+        ihold(inodep);
+        cd->inode = inodep;
+    }
+    filep->f_mapping = cd->inode->i_mapping;
+    up_write(&cd->rwsem);
+    
+    printk(KERN_INFO "SimpleChar: Device %d opened by process %d\n", cd->index, current->pid);
     return 0;
 }
 
 static int dev_release(struct inode *inodep, struct file *filep) {
-    printk(KERN_INFO "SimpleChar: Device closed\n");
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct inode *last = NULL;
+    
+    // Mappings hold a file reference, so none remain at the last release
+    down_write(&cd->rwsem);
+    if (ctx->fifo_roles & FIFO_ROLE_READER)
+        cd->fifo->reader = NULL;
+    if (ctx->fifo_roles & FIFO_ROLE_WRITER)
+        cd->fifo->writer = NULL;
+    if (--cd->open_count == 0) {
+        last = cd->inode;
+        cd->inode = NULL;
+    }
+    up_write(&cd->rwsem);
+    
+    if (last)
+        iput(last);
+    kfree(ctx);
+    
+    printk(KERN_INFO "SimpleChar: Device %d closed\n", cd->index);
     return 0;
 }
 
-static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset) {
-    int bytes_to_read;
-    int bytes_read;
+static inline loff_t char_max_buffer_size(void) {
+    return (loff_t)READ_ONCE(max_buffer_mb) << 20;
+}
+
+// Return the page at @idx, allocating a zeroed one if the slot is empty.
+// Writers (under rwsem) and mmap faults (under map_rwsem) may race here;
+// xa_cmpxchg() makes sure both end up with the same page. A non-blocking
+// @gfp also fails when the new page would have to zap a mapped zero page.
+static struct page *char_get_page(struct char_dev *cd, pgoff_t idx, gfp_t gfp) {
+    struct page *page, *cur;
+    
+    page = xa_load(&cd->pages, idx);
+    if (page)
+        return page;
+    if (!gfpflags_allow_blocking(gfp) && READ_ONCE(cd->zero_mapped))
+        return NULL;
+    
+    page = alloc_page(gfp | __GFP_ZERO | __GFP_HIGHMEM);
+    if (!page)
+        return NULL;
+    
+    cur = xa_cmpxchg(&cd->pages, idx, NULL, page, gfp);
+    if (unlikely(cur)) {
+        __free_page(page);
+        return xa_is_err(cur) ? NULL : cur;
+    }
+    
+    // Pairs with the barrier in char_map_zero_page(): either we see the
+    // flag and zap its zero page, or it sees our page and zaps itself
+    smp_mb();
+    if (READ_ONCE(cd->zero_mapped) && cd->inode)
+        unmap_mapping_range(cd->inode->i_mapping, (loff_t)idx << PAGE_SHIFT, PAGE_SIZE, 1);
+    return page;
+}
+
+// Drop all data from @from onwards: zap mappings, free whole pages and
+// zero the tail of a partial page. Caller holds rwsem.
+static void char_discard_from(struct char_dev *cd, loff_t from) {
+    pgoff_t first = DIV_ROUND_UP(from, PAGE_SIZE);
+    struct page *page;
+    unsigned long idx;
+    
+    down_write(&cd->map_rwsem);
+    if (cd->inode)
+        unmap_mapping_range(cd->inode->i_mapping, (loff_t)first << PAGE_SHIFT, 0, 1);
+    
+    xa_for_each_start(&cd->pages, idx, page, first) {
+        xa_erase(&cd->pages, idx);
+        put_page(page);
+    }
+    
+    if (offset_in_page(from)) {
+        page = xa_load(&cd->pages, from >> PAGE_SHIFT);
+        if (page)
+            memzero_page(page, offset_in_page(from), PAGE_SIZE - offset_in_page(from));
+    }
+    up_write(&cd->map_rwsem);
+}
+
+// Set the capacity to @new_size. Growing only updates the size; shrinking
+// frees the pages past the new end and zaps them from existing mappings,
+// so later accesses there get SIGBUS. Caller holds rwsem.
+static void char_resize_buffer(struct char_dev *cd, loff_t new_size) {
+    if (new_size < cd->buffer_size)
+        char_discard_from(cd, new_size);
+    
+    WRITE_ONCE(cd->buffer_size, new_size);
+    if (cd->buffer_offset > new_size)
+        WRITE_ONCE(cd->buffer_offset, new_size);
+}
+
+// Copy @len bytes at @pos into @to; holes read as zeros
+static size_t char_copy_to_iter(struct char_dev *cd, loff_t pos, size_t len,
+                                struct iov_iter *to) {
+    size_t done = 0;
+    
+    while (done < len) {
+        unsigned int offset = offset_in_page(pos);
+        size_t chunk = min_t(size_t, len - done, PAGE_SIZE - offset);
+        struct page *page = xa_load(&cd->pages, pos >> PAGE_SHIFT);
+        size_t n;
+        
+        if (page)
+            n = copy_page_to_iter(page, offset, chunk, to);
+        else
+            n = iov_iter_zero(chunk, to);
+        
+        done += n;
+        pos += n;
+        if (n < chunk)
+            break;
+    }
+    return done;
+}
+
+// Copy @len bytes from @from to @pos, allocating pages with @gfp as
+// needed. A failed non-blocking allocation is -EAGAIN.
+static ssize_t char_copy_from_iter(struct char_dev *cd, loff_t pos, size_t len,
+                                   struct iov_iter *from, gfp_t gfp) {
+    size_t done = 0;
+    
+    while (done < len) {
+        unsigned int offset = offset_in_page(pos);
+        size_t chunk = min_t(size_t, len - done, PAGE_SIZE - offset);
+        struct page *page = char_get_page(cd, pos >> PAGE_SHIFT, gfp);
+        size_t n;
+        
+        if (!page) {
+            if (done)
+                return done;
+            return gfpflags_allow_blocking(gfp) ? -ENOMEM : -EAGAIN;
+        }
+        
+        n = copy_page_from_iter(page, offset, chunk, from);
+        done += n;
+        pos += n;
+        if (n < chunk)
+            break;
+    }
+    return done;
+}
+
+// Copy out whatever of @to fits before the end of the data. Caller
+// holds rwsem and has checked that @pos is before the end.
+static size_t char_read_locked(struct char_dev *cd, loff_t pos, struct iov_iter *to) {
+    size_t len = min_t(loff_t, iov_iter_count(to), cd->buffer_offset - pos);
+    
+    return char_copy_to_iter(cd, pos, len, to);
+}
+
+// Copy @from to @pos, extending the buffer as needed. Returns the bytes
+// written or a negative error. Caller holds rwsem for write.
+static ssize_t char_write_locked(struct char_dev *cd, loff_t pos, struct iov_iter *from,
+                                 gfp_t gfp) {
+    loff_t max_size = char_max_buffer_size();
+    size_t len;
+    ssize_t copied;
+    
+    if (!iov_iter_count(from))
+        return 0;
+    if (pos >= max_size)
+        return -ENOSPC;
+    
+    // Writing past the end just extends the capacity; pages are
+    // allocated as the copy reaches them
+    len = min_t(loff_t, iov_iter_count(from), max_size - pos);
+    if (pos + len > cd->buffer_size)
+        WRITE_ONCE(cd->buffer_size, pos + len);
+    
+    // Nothing copied from a non-empty request means a bad user buffer
+    copied = char_copy_from_iter(cd, pos, len, from, gfp);
+    if (copied <= 0)
+        return copied ? copied : -EFAULT;
+    
+    if (pos + copied > cd->buffer_offset)
+        WRITE_ONCE(cd->buffer_offset, pos + copied);
+    return copied;
+}
+
+// Map a hole read-only as char_zero_page. Caller holds map_rwsem.
+static vm_fault_t char_map_zero_page(struct char_dev *cd, struct vm_fault *vmf) {
+    vm_fault_t ret;
+    
+    WRITE_ONCE(cd->zero_mapped, true);
+    smp_mb();
+    ret = vmf_insert_page(vmf->vma, vmf->address, char_zero_page);
+    
+    // A writer filled the hole meanwhile and may have missed our zero
+    // page: take it down again and let the access fault once more
+    if (xa_load(&cd->pages, vmf->pgoff))
+        unmap_mapping_range(cd->inode->i_mapping, (loff_t)vmf->pgoff << PAGE_SHIFT,
+                            PAGE_SIZE, 1);
+    return ret;
+}
+
+// Read faults on holes map the shared zero page, so scanning a sparse
+// device through a mapping allocates nothing; only write faults and
+// dev_vm_page_mkwrite() allocate store pages.
+static vm_fault_t dev_vm_fault(struct vm_fault *vmf) {
+    struct char_file *ctx = vmf->vma->vm_file->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct page *page;
+    vm_fault_t ret;
+    
+    down_read(&cd->map_rwsem);
+    if (vmf->pgoff >= DIV_ROUND_UP(READ_ONCE(cd->buffer_size), PAGE_SIZE)) {
+        ret = VM_FAULT_SIGBUS;
+        goto out;
+    }
+    
+    page = xa_load(&cd->pages, vmf->pgoff);
+    if (!page && !(vmf->flags & FAULT_FLAG_WRITE)) {
+        ret = char_map_zero_page(cd, vmf);
+        goto out;
+    }
+    if (!page)
+        page = char_get_page(cd, vmf->pgoff, GFP_KERNEL);
+    
+    // Insert under map_rwsem: a shrink either runs first and we see
+    // the new size, or runs after and zaps the page we insert here
+    if (!page)
+        ret = VM_FAULT_OOM;
+    else
+        ret = vmf_insert_page(vmf->vma, vmf->address, page);
+out:
+    up_read(&cd->map_rwsem);
+    
+    return ret;
+}
+
+// Having page_mkwrite makes the kernel map shared writable pages
+// read-only, so the first write through a mapping lands here. A store
+// page is just made writable; the zero page is replaced by a real page,
+// which char_get_page() does by zapping it so the retried access faults
+// the new page in.
+static vm_fault_t dev_vm_page_mkwrite(struct vm_fault *vmf) {
+    struct char_file *ctx = vmf->vma->vm_file->private_data;
+    struct char_dev *cd = ctx->cd;
+    vm_fault_t ret;
+    
+    down_read(&cd->map_rwsem);
+    if (vmf->pgoff >= DIV_ROUND_UP(READ_ONCE(cd->buffer_size), PAGE_SIZE)) {
+        ret = VM_FAULT_SIGBUS;
+    } else if (vmf->page == char_zero_page) {
+        ret = char_get_page(cd, vmf->pgoff, GFP_KERNEL) ? VM_FAULT_NOPAGE : VM_FAULT_OOM;
+    } else if (xa_load(&cd->pages, vmf->pgoff) != vmf->page) {
+        // Discarded since it was mapped; the zap already removed it
+        ret = VM_FAULT_NOPAGE;
+    } else {
+        lock_page(vmf->page);
+        ret = VM_FAULT_LOCKED;
+    }
+    up_read(&cd->map_rwsem);
+    
+    return ret;
+}
+
+static const struct vm_operations_struct dev_vm_ops = {
+    .fault = dev_vm_fault,
+    .page_mkwrite = dev_vm_page_mkwrite,
+};
+
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma) {
+    // Private mappings would COW on write and never reach the device
+    if (!(vma->vm_flags & VM_MAYSHARE))
+        return -EINVAL;
+    
+    // VM_MIXEDMAP lets the fault handler insert store pages directly
+    vm_flags_set(vma, VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP);
+    vma->vm_ops = &dev_vm_ops;
+    return 0;
+}
+
+// Switch between buffer and FIFO mode. Caller holds rwsem.
+static int char_set_fifo_mode(struct char_dev *cd, int size) {
+    struct char_fifo *new_fifo = NULL;
+    
+    if (cd->fifo && (cd->fifo->reader || cd->fifo->writer))
+        return -EBUSY;
+    
+    if (size) {
+        new_fifo = kzalloc(sizeof(*new_fifo), GFP_KERNEL);
+        if (!new_fifo)
+            return -ENOMEM;
+        new_fifo->data = vzalloc(size);
+        if (!new_fifo->data) {
+            kfree(new_fifo);
+            return -ENOMEM;
+        }
+        new_fifo->size = size;
+    }
+    
+    if (cd->fifo) {
+        vfree(cd->fifo->data);
+        kfree(cd->fifo);
+    }
+    WRITE_ONCE(cd->fifo, new_fifo);
+    
+    // Let pollers and blocked readers re-evaluate against the new mode
+    wake_up_interruptible_all(&cd->read_wait);
+    wake_up_interruptible_all(&cd->write_wait);
+    return 0;
+}
+
+// Return the FIFO with @role claimed for @iocb's file, NULL in buffer
+// mode, or ERR_PTR(-EBUSY) if another file already owns the role.
+// Claiming takes the device rwsem once per file (ERR_PTR(-EAGAIN) if
+// that would block an IOCB_NOWAIT caller); after that the data path is
+// lock-free.
+static struct char_fifo *fifo_get(struct kiocb *iocb, unsigned int role) {
+    struct file *filep = iocb->ki_filp;
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct char_fifo *f;
+    
+    if (ctx->fifo_roles & role)
+        return cd->fifo;
+    if (!READ_ONCE(cd->fifo))
+        return NULL;
+    
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!down_write_trylock(&cd->rwsem))
+            return ERR_PTR(-EAGAIN);
+    } else {
+        down_write(&cd->rwsem);
+    }
+    f = cd->fifo;
+    if (f) {
+        struct file **owner = (role == FIFO_ROLE_READER) ? &f->reader : &f->writer;
+        
+        if (*owner) {
+            f = ERR_PTR(-EBUSY);
+        } else {
+            *owner = filep;
+            ctx->fifo_roles |= role;
+        }
+    }
+    up_write(&cd->rwsem);
+    
+    return f;
+}
+
+// Consumer side: owns tail, observes head
+static ssize_t fifo_read(struct char_dev *cd, struct char_fifo *f, struct iov_iter *to,
+                         bool nonblock) {
+    unsigned int tail = f->tail;
+    unsigned int head, off, first;
+    size_t len = iov_iter_count(to);
+    size_t copied;
+    int ret;
+    
+    if (!len)
+        return 0;
+    
+    while ((head = smp_load_acquire(&f->head)) == tail) {
+        if (nonblock)
+            return -EAGAIN;
+        ret = wait_event_interruptible(cd->read_wait, smp_load_acquire(&f->head) != tail);
+        if (ret)
+            return ret;
+    }
+    
+    len = min_t(size_t, len, head - tail);
+    off = tail & (f->size - 1);
+    first = min_t(size_t, len, f->size - off);
+    
+    copied = copy_to_iter(f->data + off, first, to);
+    if (copied == first && len > first)
+        copied += copy_to_iter(f->data, len - first, to);
+    if (!copied)
+        return -EFAULT;
+    
+    // The producer may reuse these bytes only after the copy above
+    smp_store_release(&f->tail, tail + copied);
+    if (wq_has_sleeper(&cd->write_wait))
+        wake_up_interruptible(&cd->write_wait);
+    
+    return copied;
+}
+
+// Producer side: owns head, observes tail
+static ssize_t fifo_write(struct char_dev *cd, struct char_fifo *f, struct iov_iter *from,
+                          bool nonblock) {
+    unsigned int head = f->head;
+    unsigned int tail, off, first;
+    size_t len = iov_iter_count(from);
+    size_t copied;
+    int ret;
     
-    mutex_lock(&device_mutex);
+    if (!len)
+        return 0;
+    
+    while ((tail = smp_load_acquire(&f->tail)) + f->size == head) {
+        if (nonblock)
+            return -EAGAIN;
+        ret = wait_event_interruptible(cd->write_wait,
+                                       smp_load_acquire(&f->tail) + f->size != head);
+        if (ret)
+            return ret;
+    }
+    
+    len = min_t(size_t, len, f->size - (head - tail));
+    off = head & (f->size - 1);
+    first = min_t(size_t, len, f->size - off);
+    
+    copied = copy_from_iter(f->data + off, first, from);
+    if (copied == first && len > first)
+        copied += copy_from_iter(f->data, len - first, from);
+    if (!copied)
+        return -EFAULT;
     
-    if (*offset >= buffer_offset) {
-        mutex_unlock(&device_mutex);
+    // Publish the data before the consumer can see the new head
+    smp_store_release(&f->head, head + copied);
+    if (wq_has_sleeper(&cd->read_wait))
+        wake_up_interruptible(&cd->read_wait);
+    
+    return copied;
+}
+
+// Take the device rwsem shared for reads or exclusive for writes, or fail
+// with -EAGAIN for IOCB_NOWAIT (io_uring inline issue) so the caller
+// retries from a context that may sleep
+static int char_lock(struct char_dev *cd, struct kiocb *iocb, bool write) {
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (write)
+            return down_write_trylock(&cd->rwsem) ? 0 : -EAGAIN;
+        return down_read_trylock(&cd->rwsem) ? 0 : -EAGAIN;
+    }
+    if (write)
+        down_write(&cd->rwsem);
+    else
+        down_read(&cd->rwsem);
+    return 0;
+}
+
+// The whole iov_iter is copied under one rwsem acquisition, so
+// readv() and io_uring READV cost one lock round-trip per call rather
+// than one per segment. Reads only take the lock shared: they never
+// allocate and only advance the per-file position, so any number of
+// readers copy out in parallel.
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filep = iocb->ki_filp;
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    bool nonblock = (filep->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t len = iov_iter_count(to);
+    loff_t start_offset = iocb->ki_pos;
+    size_t copied;
+    struct char_fifo *f;
+    u64 start_ns = ktime_get_ns();
+    u64 latency_ns;
+    int ret;
+    
+    if (!len)
         return 0;
+    
+retry:
+    f = fifo_get(iocb, FIFO_ROLE_READER);
+    if (f) {
+        ssize_t n;
+        
+        if (IS_ERR(f))
+            return PTR_ERR(f);
+        n = fifo_read(cd, f, to, nonblock);
+        if (n > 0)
+            char_account(cd, false, n, start_ns);
+        return n;
+    }
+    
+    ret = char_lock(cd, iocb, false);
+    if (ret)
+        return ret;
+    
+    // Switched to FIFO mode since fifo_get() looked
+    if (cd->fifo) {
+        up_read(&cd->rwsem);
+        goto retry;
     }
     
-    bytes_to_read = min(len, (size_t)(buffer_offset - *offset));
+    // At the end of the data: O_NONBLOCK gets -EAGAIN, blocking files
+    // sleep until a writer extends the buffer, others see EOF as before
+    while (iocb->ki_pos >= cd->buffer_offset) {
+        up_read(&cd->rwsem);
+        
+        if (nonblock)
+            return -EAGAIN;
+        if (!ctx->blocking) {
+            trace_simple_char_read(start_offset, len, 0, ktime_get_ns() - start_ns);
+            return 0;
+        }
+        
+        ret = wait_event_interruptible(cd->read_wait,
+                                       iocb->ki_pos < READ_ONCE(cd->buffer_offset) ||
+                                       READ_ONCE(cd->fifo));
+        if (ret)
+            return ret;
+        
+        // char_set_fifo_mode() wakes us to start over in FIFO mode
+        if (READ_ONCE(cd->fifo))
+            goto retry;
+        down_read(&cd->rwsem);
+    }
     
-    if (copy_to_user(buffer, device_buffer + *offset, bytes_to_read)) {
-        mutex_unlock(&device_mutex);
+    copied = char_read_locked(cd, iocb->ki_pos, to);
+    if (!copied) {
+        up_read(&cd->rwsem);
         return -EFAULT;
     }
     
-    *offset += bytes_to_read;
-    read_count++;
+    iocb->ki_pos += copied;
+    
+    up_read(&cd->rwsem);
     
-    mutex_unlock(&device_mutex);
+    latency_ns = char_account(cd, false, copied, start_ns);
     
-    printk(KERN_DEBUG "SimpleChar: Read %d bytes at offset %lld\n", bytes_to_read, *offset);
-    return bytes_to_read;
+    trace_simple_char_read(start_offset, len, copied, latency_ns);
+    sc_debug(1, "Read %zu bytes at offset %lld\n", copied, start_offset);
+    return copied;
 }
 
-static ssize_t dev_write(struct file *filep, const char *buffer, size_t len, loff_t *offset) {
-    int bytes_to_write;
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct file *filep = iocb->ki_filp;
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    bool nonblock = (filep->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    gfp_t gfp = (iocb->ki_flags & IOCB_NOWAIT) ? GFP_NOWAIT | __GFP_NOWARN : GFP_KERNEL;
+    size_t len = iov_iter_count(from);
+    loff_t start_offset = iocb->ki_pos;
+    ssize_t copied;
+    struct char_fifo *f;
+    u64 start_ns = ktime_get_ns();
+    u64 latency_ns;
+    int ret;
     
-    mutex_lock(&device_mutex);
+    if (!len)
+        return 0;
     
-    // If writing beyond buffer, resize buffer
-    if (*offset + len > buffer_size) {
-        int new_size = max(buffer_size * 2, *offset + len);
-        char *new_buffer = krealloc(device_buffer, new_size, GFP_KERNEL);
-        if (!new_buffer) {
-            mutex_unlock(&device_mutex);
-            return -ENOMEM;
+    f = fifo_get(iocb, FIFO_ROLE_WRITER);
+    if (f) {
+        ssize_t n;
+        
+        if (IS_ERR(f))
+            return PTR_ERR(f);
+        n = fifo_write(cd, f, from, nonblock);
+        if (n > 0)
+            char_account(cd, true, n, start_ns);
+        return n;
+    }
+    
+    ret = char_lock(cd, iocb, true);
+    if (ret)
+        return ret;
+    
+    copied = char_write_locked(cd, iocb->ki_pos, from, gfp);
+    if (copied < 0) {
+        up_write(&cd->rwsem);
+        return copied;
+    }
+    
+    iocb->ki_pos += copied;
+    
+    up_write(&cd->rwsem);
+    
+    latency_ns = char_account(cd, true, copied, start_ns);
+    
+    if (wq_has_sleeper(&cd->read_wait))
+        wake_up_interruptible(&cd->read_wait);
+    
+    trace_simple_char_write(start_offset, len, copied, latency_ns);
+    sc_debug(1, "Wrote %zd bytes at offset %lld\n", copied, start_offset);
+    return copied;
+}
+
+// Zero-copy splice from the buffer: each pipe buffer takes a reference
+// on the store page itself (the shared zero page for holes), so data
+// reaches the pipe without being copied. Like page-cache splice, a later
+// write to the same range may be visible to whoever drains the pipe.
+// FIFO mode falls back to copying through read_iter.
+static ssize_t dev_splice_read(struct file *in, loff_t *ppos,
+                               struct pipe_inode_info *pipe, size_t len,
+                               unsigned int flags) {
+    struct char_file *ctx = in->private_data;
+    struct char_dev *cd = ctx->cd;
+    u64 start_ns = ktime_get_ns();
+    loff_t pos = *ppos;
+    ssize_t spliced = 0;
+    
+    down_read(&cd->rwsem);
+    if (cd->fifo) {
+        up_read(&cd->rwsem);
+        return copy_splice_read(in, ppos, pipe, len, flags);
+    }
+    
+    len = pos < cd->buffer_offset ? min_t(loff_t, len, cd->buffer_offset - pos) : 0;
+    while (len) {
+        struct page *page = xa_load(&cd->pages, pos >> PAGE_SHIFT);
+        struct pipe_buffer buf = {
+            .ops = &nosteal_pipe_buf_ops,
+            .offset = offset_in_page(pos),
+            .len = min_t(size_t, len, PAGE_SIZE - offset_in_page(pos)),
+        };
+        ssize_t ret;
+        
+        buf.page = page ? page : ZERO_PAGE(0);
+        get_page(buf.page);
+        
+        // add_to_pipe() drops the reference itself on failure
+        ret = add_to_pipe(pipe, &buf);
+        if (ret < 0) {
+            if (!spliced)
+                spliced = ret;
+            break;
         }
-        device_buffer = new_buffer;
-        buffer_size = new_size;
-        printk(KERN_INFO "SimpleChar: Buffer resized to %d bytes\n", buffer_size);
+        
+        pos += ret;
+        len -= ret;
+        spliced += ret;
+    }
+    up_read(&cd->rwsem);
+    
+    if (spliced > 0) {
+        *ppos = pos;
+        char_account(cd, false, spliced, start_ns);
     }
+    return spliced;
+}
+
+static __poll_t dev_poll(struct file *filep, poll_table *wait) {
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct char_fifo *f;
+    __poll_t mask = 0;
+    
+    poll_wait(filep, &cd->read_wait, wait);
+    poll_wait(filep, &cd->write_wait, wait);
     
-    bytes_to_write = min(len, (size_t)(buffer_size - *offset));
+    // Role owners may use the FIFO locklessly; anyone else needs the
+    // lock to keep the mode from changing under them
+    if (!ctx->fifo_roles)
+        down_read(&cd->rwsem);
     
-    if (copy_from_user(device_buffer + *offset, buffer, bytes_to_write)) {
-        mutex_unlock(&device_mutex);
+    f = cd->fifo;
+    if (f) {
+        unsigned int head = smp_load_acquire(&f->head);
+        unsigned int tail = smp_load_acquire(&f->tail);
+        
+        if (head != tail)
+            mask |= EPOLLIN | EPOLLRDNORM;
+        if (head - tail != f->size)
+            mask |= EPOLLOUT | EPOLLWRNORM;
+    } else {
+        if (READ_ONCE(filep->f_pos) < READ_ONCE(cd->buffer_offset))
+            mask |= EPOLLIN | EPOLLRDNORM;
+        // The buffer grows on demand, so it is always writable
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
+    
+    if (!ctx->fifo_roles)
+        up_read(&cd->rwsem);
+    
+    return mask;
+}
+
+static long char_submit_batch(struct file *filep, struct char_batch __user *ubatch) {
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct char_batch batch;
+    struct char_batch_op *ops;
+    bool write = false;
+    bool wrote = false;
+    loff_t pos;
+    long ret;
+    u32 i;
+    
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
         return -EFAULT;
+    if (batch.flags || !batch.nr_ops || batch.nr_ops > CHAR_BATCH_MAX)
+        return -EINVAL;
+    
+    ops = memdup_array_user(u64_to_user_ptr(batch.ops), batch.nr_ops, sizeof(*ops));
+    if (IS_ERR(ops))
+        return PTR_ERR(ops);
+    
+    // Only batches that modify the buffer need the lock exclusively
+    for (i = 0; i < batch.nr_ops; i++) {
+        if (ops[i].op > CHAR_BATCH_SEEK) {
+            kfree(ops);
+            return -EINVAL;
+        }
+        if (ops[i].op == CHAR_BATCH_WRITE)
+            write = true;
     }
     
-    if (*offset + bytes_to_write > buffer_offset) {
-        buffer_offset = *offset + bytes_to_write;
+    if (write)
+        down_write(&cd->rwsem);
+    else
+        down_read(&cd->rwsem);
+    
+    if (cd->fifo) {
+        ret = -EBUSY;
+        goto out_unlock;
     }
     
-    *offset += bytes_to_write;
-    write_count++;
+    pos = filep->f_pos;
+    for (i = 0; i < batch.nr_ops; i++) {
+        struct char_batch_op *op = &ops[i];
+        loff_t at = op->offset < 0 ? pos : op->offset;
+        u64 start_ns = ktime_get_ns();
+        struct iov_iter iter;
+        ssize_t n;
+        
+        if (op->op == CHAR_BATCH_SEEK) {
+            if (op->offset < 0) {
+                op->result = -EINVAL;
+                break;
+            }
+            pos = op->result = op->offset;
+            continue;
+        }
+        
+        n = import_ubuf(op->op == CHAR_BATCH_READ ? ITER_DEST : ITER_SOURCE,
+                        u64_to_user_ptr(op->buf), op->len, &iter);
+        if (!n) {
+            if (op->op == CHAR_BATCH_READ) {
+                n = at < cd->buffer_offset ? char_read_locked(cd, at, &iter) : 0;
+                if (!n && op->len && at < cd->buffer_offset)
+                    n = -EFAULT;
+            } else {
+                n = char_write_locked(cd, at, &iter, GFP_KERNEL);
+                if (n > 0)
+                    wrote = true;
+            }
+        }
+        
+        op->result = n;
+        if (n < 0)
+            break;
+        if (op->offset < 0)
+            pos = at + n;
+        char_account(cd, op->op == CHAR_BATCH_WRITE, n, start_ns);
+    }
+    filep->f_pos = pos;
+    ret = i;
     
-    mutex_unlock(&device_mutex);
+out_unlock:
+    if (write)
+        up_write(&cd->rwsem);
+    else
+        up_read(&cd->rwsem);
     
-    printk(KERN_DEBUG "SimpleChar: Wrote %d bytes at offset %lld\n", bytes_to_write, *offset);
-    return bytes_to_write;
+    if (wrote && wq_has_sleeper(&cd->read_wait))
+        wake_up_interruptible(&cd->read_wait);
+    
+    // Report results for every op that ran, including a failing one
+    if (ret >= 0 && copy_to_user(u64_to_user_ptr(batch.ops), ops,
+                                 min_t(u32, ret + 1, batch.nr_ops) * sizeof(*ops)))
+        ret = -EFAULT;
+    kfree(ops);
+    return ret;
 }
 
-static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+static long char_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct char_file *ctx = filep->private_data;
+    struct char_dev *cd = ctx->cd;
+    struct char_latency_hist hist;
+    struct char_stats_ext ext;
     struct char_stats stats;
     
     switch (cmd) {
         case CHAR_GET_SIZE:
-            if (copy_to_user((int *)arg, &buffer_size, sizeof(int)))
-                return -EFAULT;
+            {
+                int size = min_t(loff_t, READ_ONCE(cd->buffer_size), INT_MAX);
+                
+                if (copy_to_user((int *)arg, &size, sizeof(int)))
+                    return -EFAULT;
+            }
+            break;
+            
+        case CHAR_GET_SIZE64:
+            {
+                u64 size = READ_ONCE(cd->buffer_size);
+                
+                if (copy_to_user((u64 *)arg, &size, sizeof(size)))
+                    return -EFAULT;
+            }
             break;
             
         case CHAR_RESET_BUFFER:
-            mutex_lock(&device_mutex);
-            memset(device_buffer, 0, buffer_size);
-            buffer_offset = 0;
-            mutex_unlock(&device_mutex);
-            printk(KERN_INFO "SimpleChar: Buffer reset\n");
+            down_write(&cd->rwsem);
+            char_discard_from(cd, 0);
+            WRITE_ONCE(cd->buffer_offset, 0);
+            up_write(&cd->rwsem);
+            printk(KERN_INFO "SimpleChar: Device %d buffer reset\n", cd->index);
             break;
             
         case CHAR_GET_STATS:
-            mutex_lock(&device_mutex);
-            stats.read_count = read_count;
-            stats.write_count = write_count;
-            stats.buffer_used = buffer_offset;
-            stats.buffer_size = buffer_size;
-            mutex_unlock(&device_mutex);
+            // The legacy struct has int fields; clamp large values
+            char_get_stats(cd, &ext);
+            stats.read_count = min_t(u64, ext.read_ops, INT_MAX);
+            stats.write_count = min_t(u64, ext.write_ops, INT_MAX);
+            stats.buffer_used = min_t(u64, ext.buffer_used, INT_MAX);
+            stats.buffer_size = min_t(u64, ext.buffer_size, INT_MAX);
             
             if (copy_to_user((struct char_stats *)arg, &stats, sizeof(stats)))
                 return -EFAULT;
             break;
             
+        case CHAR_GET_STATS_EXT:
+            char_get_stats(cd, &ext);
+            if (copy_to_user((struct char_stats_ext *)arg, &ext, sizeof(ext)))
+                return -EFAULT;
+            break;
+            
+        case CHAR_SUBMIT_BATCH:
+            return char_submit_batch(filep, (struct char_batch __user *)arg);
+            
+        case CHAR_GET_LATENCY_HIST:
+            if (copy_from_user(&hist.op, (u32 *)arg, sizeof(hist.op)))
+                return -EFAULT;
+            if (hist.op >= CHAR_LAT_NR)
+                return -EINVAL;
+            
+            hist.nr_buckets = LAT_HIST_BUCKETS;
+            char_lat_get(cd, hist.op, hist.buckets);
+            if (copy_to_user((struct char_latency_hist *)arg, &hist, sizeof(hist)))
+                return -EFAULT;
+            break;
+            
         case CHAR_SET_BUFFER_SIZE:
             {
                 int new_size;
                 if (copy_from_user(&new_size, (int *)arg, sizeof(int)))
                     return -EFAULT;
                 
-                if (new_size < 1 || new_size > 65536) {
+                if (new_size < 1 || new_size > char_max_buffer_size()) {
                     return -EINVAL;
                 }
                 
-                mutex_lock(&device_mutex);
-                char *new_buffer = krealloc(device_buffer, new_size, GFP_KERNEL);
-                if (!new_buffer) {
-                    mutex_unlock(&device_mutex);
-                    return -ENOMEM;
+                down_write(&cd->rwsem);
+                char_resize_buffer(cd, new_size);
+                up_write(&cd->rwsem);
+                printk(KERN_INFO "SimpleChar: Device %d buffer size set to %d\n", cd->index, new_size);
+            }
+            break;
+            
+        case CHAR_SET_BUFFER_SIZE64:
+            {
+                u64 new_size;
+                if (copy_from_user(&new_size, (u64 *)arg, sizeof(new_size)))
+                    return -EFAULT;
+                
+                if (new_size < 1 || new_size > char_max_buffer_size()) {
+                    return -EINVAL;
                 }
-                device_buffer = new_buffer;
-                buffer_size = new_size;
-                if (buffer_offset > buffer_size) {
-                    buffer_offset = buffer_size;
+                
+                down_write(&cd->rwsem);
+                char_resize_buffer(cd, new_size);
+                up_write(&cd->rwsem);
+                printk(KERN_INFO "SimpleChar: Device %d buffer size set to %llu\n",
+                       cd->index, new_size);
+            }
+            break;
+            
+        case CHAR_SET_BLOCKING:
+            {
+                int blocking;
+                
+                if (copy_from_user(&blocking, (int *)arg, sizeof(int)))
+                    return -EFAULT;
+                ctx->blocking = blocking != 0;
+            }
+            break;
+            
+        case CHAR_SET_FIFO_MODE:
+            {
+                int fifo_size;
+                int ret;
+                
+                if (copy_from_user(&fifo_size, (int *)arg, sizeof(int)))
+                    return -EFAULT;
+                
+                if (fifo_size != 0 &&
+                    (fifo_size < PAGE_SIZE || fifo_size > FIFO_MAX_SIZE ||
+                     !is_power_of_2(fifo_size))) {
+                    return -EINVAL;
                 }
-                mutex_unlock(&device_mutex);
-                printk(KERN_INFO "SimpleChar: Buffer size set to %d\n", new_size);
+                
+                down_write(&cd->rwsem);
+                ret = char_set_fifo_mode(cd, fifo_size);
+                up_write(&cd->rwsem);
+                if (ret)
+                    return ret;
+                
+                if (fifo_size)
+                    printk(KERN_INFO "SimpleChar: Device %d FIFO mode, %d byte ring\n",
+                           cd->index, fifo_size);
+                else
+                    printk(KERN_INFO "SimpleChar: Device %d buffer mode\n", cd->index);
             }
             break;
             
@@ -197,53 +1297,164 @@ static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
     return 0;
 }
 
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct char_file *ctx = filep->private_data;
+    u64 start_ns = ktime_get_ns();
+    long ret = char_ioctl(filep, cmd, arg);
+    
+    char_lat_record(ctx->cd, CHAR_LAT_IOCTL, ktime_get_ns() - start_ns);
+    return ret;
+}
+
+// Commands that only read per-CPU counters or READ_ONCE() sizes never
+// sleep on a lock and can complete inline from the submitting task
+static bool char_cmd_may_block(unsigned int cmd) {
+    switch (cmd) {
+        case CHAR_GET_SIZE:
+        case CHAR_GET_SIZE64:
+        case CHAR_GET_STATS:
+        case CHAR_GET_STATS_EXT:
+        case CHAR_GET_LATENCY_HIST:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static int dev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    const struct char_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+    
+    // Anything that takes the device rwsem is punted: -EAGAIN on the inline
+    // attempt makes io_uring retry from an io-wq worker that may sleep
+    if ((issue_flags & IO_URING_F_NONBLOCK) && char_cmd_may_block(ioucmd->cmd_op))
+        return -EAGAIN;
+    
+    return dev_ioctl(ioucmd->file, ioucmd->cmd_op, READ_ONCE(cmd->arg));
+}
+
+// Only the per-file position changes, so no device lock is needed;
+// SEEK_END is relative to the end of the written data
 static loff_t dev_llseek(struct file *filep, loff_t offset, int whence) {
-    loff_t newpos;
+    struct char_file *ctx = filep->private_data;
     
-    mutex_lock(&device_mutex);
+    return generic_file_llseek_size(filep, offset, whence, MAX_LFS_FILESIZE,
+                                    READ_ONCE(ctx->cd->buffer_offset));
+}
+
+// sysfs: /sys/class/simple_char_class/simple_charN/<op>_latency_hist, one
+// "<bucket lower bound in ns> <count>" line per bucket
+static ssize_t char_lat_show(struct device *dev, unsigned int op, char *buf) {
+    struct char_dev *cd = dev_get_drvdata(dev);
+    u64 buckets[LAT_HIST_BUCKETS];
+    int len = 0, i;
     
-    switch (whence) {
-        case SEEK_SET:
-            newpos = offset;
-            break;
-        case SEEK_CUR:
-            newpos = filep->f_pos + offset;
-            break;
-        case SEEK_END:
-            newpos = buffer_offset + offset;
-            break;
-        default:
-            mutex_unlock(&device_mutex);
-            return -EINVAL;
+    char_lat_get(cd, op, buckets);
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        len += sysfs_emit_at(buf, len, "%llu %llu\n",
+                             i ? 1ULL << (i - 1) : 0ULL, buckets[i]);
+    return len;
+}
+
+static ssize_t read_latency_hist_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf) {
+    return char_lat_show(dev, CHAR_LAT_READ, buf);
+}
+static DEVICE_ATTR_RO(read_latency_hist);
+
+static ssize_t write_latency_hist_show(struct device *dev,
+                                       struct device_attribute *attr, char *buf) {
+    return char_lat_show(dev, CHAR_LAT_WRITE, buf);
+}
+static DEVICE_ATTR_RO(write_latency_hist);
+
+static ssize_t ioctl_latency_hist_show(struct device *dev,
+                                       struct device_attribute *attr, char *buf) {
+    return char_lat_show(dev, CHAR_LAT_IOCTL, buf);
+}
+static DEVICE_ATTR_RO(ioctl_latency_hist);
+
+static struct attribute *char_attrs[] = {
+    &dev_attr_read_latency_hist.attr,
+    &dev_attr_write_latency_hist.attr,
+    &dev_attr_ioctl_latency_hist.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(char);
+
+static int char_dev_create(struct char_dev *cd, int index) {
+    dev_t dev_num = MKDEV(major_number, index);
+    int cpu, ret;
+    
+    cd->index = index;
+    init_rwsem(&cd->rwsem);
+    init_rwsem(&cd->map_rwsem);
+    xa_init(&cd->pages);
+    cd->buffer_size = BUFFER_SIZE;
+    init_waitqueue_head(&cd->read_wait);
+    init_waitqueue_head(&cd->write_wait);
+    
+    cd->stats = alloc_percpu(struct char_pcpu_stats);
+    cd->lat = alloc_percpu(struct char_lat_hist);
+    if (!cd->stats || !cd->lat) {
+        ret = -ENOMEM;
+        goto out_free_percpu;
     }
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(cd->stats, cpu)->syncp);
     
-    if (newpos < 0) {
-        mutex_unlock(&device_mutex);
-        return -EINVAL;
+    cdev_init(&cd->cdev, &fops);
+    cd->cdev.owner = THIS_MODULE;
+    
+    ret = cdev_add(&cd->cdev, dev_num, 1);
+    if (ret) {
+        printk(KERN_ALERT "SimpleChar: Failed to add cdev %d\n", index);
+        goto out_free_percpu;
+    }
+    
+    cd->device = device_create_with_groups(char_class, NULL, dev_num, cd,
+                                           char_groups, DEVICE_NAME "%d", index);
+    if (IS_ERR(cd->device)) {
+        printk(KERN_ALERT "SimpleChar: Failed to create device %d\n", index);
+        ret = PTR_ERR(cd->device);
+        cd->device = NULL;
+        goto out_del_cdev;
     }
     
-    filep->f_pos = newpos;
-    mutex_unlock(&device_mutex);
+    return 0;
+    
+out_del_cdev:
+    cdev_del(&cd->cdev);
+out_free_percpu:
+    free_percpu(cd->lat);
+    free_percpu(cd->stats);
+    return ret;
+}
+
+static void char_dev_destroy(struct char_dev *cd) {
+    device_destroy(char_class, MKDEV(major_number, cd->index));
+    cdev_del(&cd->cdev);
+    
+    char_discard_from(cd, 0);
+    xa_destroy(&cd->pages);
+    char_set_fifo_mode(cd, 0);
     
-    return newpos;
+    free_percpu(cd->lat);
+    free_percpu(cd->stats);
 }
 
 static int __init char_init(void) {
     dev_t dev_num;
+    int ret, i;
     
     printk(KERN_INFO "SimpleChar: Initializing enhanced driver\n");
     
-    // Allocate buffer
-    device_buffer = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-    if (!device_buffer) {
-        printk(KERN_ALERT "SimpleChar: Failed to allocate buffer\n");
-        return -ENOMEM;
+    if (num_devices < 1 || num_devices > MAX_DEVICES) {
+        printk(KERN_ALERT "SimpleChar: num_devices must be 1..%d\n", MAX_DEVICES);
+        return -EINVAL;
     }
-    memset(device_buffer, 0, BUFFER_SIZE);
     
-    // Allocate major number
-    if (alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME) < 0) {
-        kfree(device_buffer);
+    // Allocate major number with one minor per device
+    if (alloc_chrdev_region(&dev_num, 0, num_devices, DEVICE_NAME) < 0) {
         printk(KERN_ALERT "SimpleChar: Failed to allocate major number\n");
         return -1;
     }
@@ -251,60 +1462,59 @@ static int __init char_init(void) {
     major_number = MAJOR(dev_num);
     printk(KERN_INFO "SimpleChar: Registered with major number %d\n", major_number);
     
-    // Initialize cdev
-    cdev_init(&char_cdev, &fops);
-    char_cdev.owner = THIS_MODULE;
+    char_zero_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!char_zero_page) {
+        unregister_chrdev_region(dev_num, num_devices);
+        return -ENOMEM;
+    }
     
-    if (cdev_add(&char_cdev, dev_num, 1) < 0) {
-        kfree(device_buffer);
-        unregister_chrdev_region(dev_num, 1);
-        printk(KERN_ALERT "SimpleChar: Failed to add cdev\n");
-        return -1;
+    char_devs = kcalloc(num_devices, sizeof(*char_devs), GFP_KERNEL);
+    if (!char_devs) {
+        __free_page(char_zero_page);
+        unregister_chrdev_region(dev_num, num_devices);
+        return -ENOMEM;
     }
     
     // Create class
-    char_class = class_create(THIS_MODULE, CLASS_NAME);
+    char_class = class_create(CLASS_NAME);
     if (IS_ERR(char_class)) {
-        kfree(device_buffer);
-        cdev_del(&char_cdev);
-        unregister_chrdev_region(dev_num, 1);
+        kfree(char_devs);
+        __free_page(char_zero_page);
+        unregister_chrdev_region(dev_num, num_devices);
         printk(KERN_ALERT "SimpleChar: Failed to create class\n");
         return PTR_ERR(char_class);
     }
     
-    // Create device
-    char_device = device_create(char_class, NULL, dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(char_device)) {
-        kfree(device_buffer);
-        class_destroy(char_class);
-        cdev_del(&char_cdev);
-        unregister_chrdev_region(dev_num, 1);
-        printk(KERN_ALERT "SimpleChar: Failed to create device\n");
-        return PTR_ERR(char_device);
+    // Create devices
+    for (i = 0; i < num_devices; i++) {
+        ret = char_dev_create(&char_devs[i], i);
+        if (ret) {
+            while (i--)
+                char_dev_destroy(&char_devs[i]);
+            class_destroy(char_class);
+            kfree(char_devs);
+            __free_page(char_zero_page);
+            unregister_chrdev_region(dev_num, num_devices);
+            return ret;
+        }
     }
     
-    mutex_init(&device_mutex);
-    
     printk(KERN_INFO "SimpleChar: Driver initialized successfully\n");
-    printk(KERN_INFO "SimpleChar: Device buffer size: %d bytes\n", buffer_size);
+    printk(KERN_INFO "SimpleChar: %u device(s), buffer size: %d bytes (max %lu MB)\n",
+           num_devices, BUFFER_SIZE, max_buffer_mb);
     
     return 0;
 }
 
 static void __exit char_exit(void) {
-    dev_t dev_num = MKDEV(major_number, 0);
-    
-    if (char_device)
-        device_destroy(char_class, dev_num);
-    if (char_class)
-        class_destroy(char_class);
-    cdev_del(&char_cdev);
-    unregister_chrdev_region(dev_num, 1);
-    
-    if (device_buffer)
-        kfree(device_buffer);
+    int i;
     
-    mutex_destroy(&device_mutex);
+    for (i = 0; i < num_devices; i++)
+        char_dev_destroy(&char_devs[i]);
+    class_destroy(char_class);
+    kfree(char_devs);
+    __free_page(char_zero_page);
+    unregister_chrdev_region(MKDEV(major_number, 0), num_devices);
     
     printk(KERN_INFO "SimpleChar: Driver removed\n");
 }
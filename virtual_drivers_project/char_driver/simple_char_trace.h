@@ -0,0 +1,53 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM simple_char
+
+#if !defined(_SIMPLE_CHAR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SIMPLE_CHAR_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+// Tracepoints for simple_char data transfers. Disabled tracepoints are a
+// patched-out branch; enable them with
+//   echo 1 > /sys/kernel/tracing/events/simple_char/enable
+
+DECLARE_EVENT_CLASS(simple_char_io,
+    TP_PROTO(loff_t offset, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(offset, len, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(loff_t, offset)
+        __field(size_t, len)
+        __field(ssize_t, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("offset=%lld len=%zu ret=%zd latency_ns=%llu",
+              (long long)__entry->offset, __entry->len, __entry->ret,
+              (unsigned long long)__entry->latency_ns)
+);
+
+DEFINE_EVENT(simple_char_io, simple_char_read,
+    TP_PROTO(loff_t offset, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(offset, len, ret, latency_ns)
+);
+
+DEFINE_EVENT(simple_char_io, simple_char_write,
+    TP_PROTO(loff_t offset, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(offset, len, ret, latency_ns)
+);
+
+#endif /* _SIMPLE_CHAR_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE simple_char_trace
+#include <trace/define_trace.h>
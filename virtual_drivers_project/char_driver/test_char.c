@@ -3,15 +3,270 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
-#define DEVICE_PATH "/dev/simple_char"
+#define DEVICE_PATH "/dev/simple_char0"
 #define BUFFER_SIZE 1024
 
+// FIFO mode (must match driver): ring size in bytes, 0 leaves FIFO mode
+#define CHAR_SET_FIFO_MODE _IOW('C', 5, int)
+#define FIFO_TEST_SIZE 4096
+
+// Batched submission (must match driver)
+#define CHAR_SUBMIT_BATCH _IOW('C', 11, struct char_batch)
+
+enum {
+    CHAR_BATCH_READ,
+    CHAR_BATCH_WRITE,
+    CHAR_BATCH_SEEK,
+};
+
+struct char_batch_op {
+    uint32_t op;
+    uint32_t reserved;
+    int64_t offset;
+    uint64_t buf;
+    uint64_t len;
+    int64_t result;
+};
+
+struct char_batch {
+    uint64_t ops;
+    uint32_t nr_ops;
+    uint32_t flags;
+};
+
+// Marks a result the driver must not have written back
+#define RESULT_UNSET (-12345)
+
+static void set_op(struct char_batch_op *op, uint32_t type, int64_t offset,
+                   void *buf, uint64_t len) {
+    memset(op, 0, sizeof(*op));
+    op->op = type;
+    op->offset = offset;
+    op->buf = (uintptr_t)buf;
+    op->len = len;
+    op->result = RESULT_UNSET;
+}
+
+static long submit_batch(int fd, struct char_batch_op *ops, uint32_t nr_ops) {
+    struct char_batch batch = {
+        .ops = (uintptr_t)ops,
+        .nr_ops = nr_ops,
+    };
+    
+    return ioctl(fd, CHAR_SUBMIT_BATCH, &batch);
+}
+
+static int check_result(const char *test, struct char_batch_op *ops, int i, int64_t expected) {
+    if (ops[i].result != expected) {
+        printf("%s: op %d returned %lld, expected %lld\n", test, i,
+               (long long)ops[i].result, (long long)expected);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes after the existing data through the file position, reads it
+// back at an explicit offset, and checks the position the batch leaves
+static int test_batch_mixed(int fd, off_t base) {
+    const char *test = "Batch mixed";
+    struct char_batch_op ops[5];
+    char head[8], tail[8];
+    int err = 0;
+    long ret;
+    
+    set_op(&ops[0], CHAR_BATCH_SEEK, base, NULL, 0);
+    set_op(&ops[1], CHAR_BATCH_WRITE, -1, "abc", 3);
+    set_op(&ops[2], CHAR_BATCH_WRITE, -1, "def", 3);
+    set_op(&ops[3], CHAR_BATCH_READ, base, tail, 6);
+    set_op(&ops[4], CHAR_BATCH_READ, 0, head, 5);
+    
+    ret = submit_batch(fd, ops, 5);
+    if (ret != 5) {
+        printf("%s: ioctl returned %ld, expected 5 (%s)\n", test, ret,
+               ret < 0 ? strerror(errno) : "stopped early");
+        return -1;
+    }
+    
+    err |= check_result(test, ops, 0, base);
+    err |= check_result(test, ops, 1, 3);
+    err |= check_result(test, ops, 2, 3);
+    err |= check_result(test, ops, 3, 6);
+    err |= check_result(test, ops, 4, 5);
+    if (memcmp(tail, "abcdef", 6) || memcmp(head, "Hello", 5)) {
+        printf("%s: read back wrong data\n", test);
+        err = -1;
+    }
+    if (lseek(fd, 0, SEEK_CUR) != base + 6) {
+        printf("%s: file position not advanced by the writes\n", test);
+        err = -1;
+    }
+    
+    if (!err)
+        printf("%s: OK\n", test);
+    return err;
+}
+
+// Zero-length reads and writes succeed with 0 and the batch carries on
+static int test_batch_zero_length(int fd) {
+    const char *test = "Batch zero-length";
+    struct char_batch_op ops[3];
+    char buf[8];
+    int err = 0;
+    long ret;
+    
+    set_op(&ops[0], CHAR_BATCH_WRITE, -1, buf, 0);
+    set_op(&ops[1], CHAR_BATCH_READ, 0, buf, 0);
+    set_op(&ops[2], CHAR_BATCH_READ, 0, buf, 5);
+    
+    ret = submit_batch(fd, ops, 3);
+    if (ret != 3) {
+        printf("%s: ioctl returned %ld, expected 3 (%s)\n", test, ret,
+               ret < 0 ? strerror(errno) : "stopped early");
+        return -1;
+    }
+    
+    err |= check_result(test, ops, 0, 0);
+    err |= check_result(test, ops, 1, 0);
+    err |= check_result(test, ops, 2, 5);
+    
+    if (!err)
+        printf("%s: OK\n", test);
+    return err;
+}
+
+// A bad buffer part way through stops the batch at that op: the ioctl
+// returns how many ops ran, the failing op reports -EFAULT and the ops
+// after it neither run nor get a result
+static int test_batch_bad_pointer(int fd, off_t base) {
+    const char *test = "Batch bad pointer";
+    struct char_batch_op ops[3];
+    char check[2];
+    void *bad;
+    int err = 0;
+    long ret;
+    
+    // An address that was mapped once and no longer is
+    bad = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bad == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    munmap(bad, 4096);
+    
+    set_op(&ops[0], CHAR_BATCH_WRITE, base, "AB", 2);
+    set_op(&ops[1], CHAR_BATCH_READ, 0, bad, 4);
+    set_op(&ops[2], CHAR_BATCH_WRITE, base + 2, "CD", 2);
+    
+    ret = submit_batch(fd, ops, 3);
+    if (ret != 1) {
+        printf("%s: ioctl returned %ld, expected 1 (%s)\n", test, ret,
+               ret < 0 ? strerror(errno) : "wrong count");
+        return -1;
+    }
+    
+    err |= check_result(test, ops, 0, 2);
+    err |= check_result(test, ops, 1, -EFAULT);
+    err |= check_result(test, ops, 2, RESULT_UNSET);
+    
+    // The op after the failure must not have written anything
+    if (pread(fd, check, 2, base + 2) != 2 || memcmp(check, "cd", 2)) {
+        printf("%s: op after the failure modified the device\n", test);
+        err = -1;
+    }
+    
+    if (!err)
+        printf("%s: OK\n", test);
+    return err;
+}
+
+// FIFO mode: one producer and one consumer file, each with its own end
+// of the ring. A second producer is refused, and an empty ring is
+// -EAGAIN for O_NONBLOCK readers. Leaves the device in buffer mode.
+static int test_fifo(int fd) {
+    const char *test = "FIFO";
+    int size = FIFO_TEST_SIZE, off = 0;
+    int rfd = -1, wfd = -1, wfd2 = -1;
+    char buf[32];
+    int err = -1;
+    
+    if (ioctl(fd, CHAR_SET_FIFO_MODE, &size) < 0) {
+        printf("%s: CHAR_SET_FIFO_MODE failed: %s\n", test, strerror(errno));
+        return -1;
+    }
+    
+    rfd = open(DEVICE_PATH, O_RDONLY | O_NONBLOCK);
+    wfd = open(DEVICE_PATH, O_WRONLY);
+    wfd2 = open(DEVICE_PATH, O_WRONLY);
+    if (rfd < 0 || wfd < 0 || wfd2 < 0) {
+        perror("Failed to open FIFO ends");
+        goto out;
+    }
+    
+    if (read(rfd, buf, sizeof(buf)) != -1 || errno != EAGAIN) {
+        printf("%s: read of an empty FIFO did not fail with EAGAIN\n", test);
+        goto out;
+    }
+    
+    if (write(wfd, "first ", 6) != 6 || write(wfd, "second", 6) != 6) {
+        printf("%s: write failed: %s\n", test, strerror(errno));
+        goto out;
+    }
+    if (write(wfd2, "x", 1) != -1 || errno != EBUSY) {
+        printf("%s: second writer was not refused with EBUSY\n", test);
+        goto out;
+    }
+    
+    // The consumer drains in order from its own position
+    while (off < 12) {
+        ssize_t n = read(rfd, buf + off, off ? 12 - off : 4);
+        
+        if (n <= 0) {
+            printf("%s: read failed: %s\n", test, n < 0 ? strerror(errno) : "EOF");
+            goto out;
+        }
+        off += n;
+    }
+    if (memcmp(buf, "first second", 12)) {
+        printf("%s: read back wrong data\n", test);
+        goto out;
+    }
+    if (read(rfd, buf, sizeof(buf)) != -1 || errno != EAGAIN) {
+        printf("%s: drained FIFO did not fail with EAGAIN\n", test);
+        goto out;
+    }
+    
+    err = 0;
+out:
+    if (rfd >= 0)
+        close(rfd);
+    if (wfd >= 0)
+        close(wfd);
+    if (wfd2 >= 0)
+        close(wfd2);
+    
+    // The ends are closed, so the mode can change again
+    size = 0;
+    if (ioctl(fd, CHAR_SET_FIFO_MODE, &size) < 0) {
+        printf("%s: leaving FIFO mode failed: %s\n", test, strerror(errno));
+        err = -1;
+    }
+    
+    if (!err)
+        printf("%s: OK\n", test);
+    return err;
+}
+
 int main() {
     int fd;
     char write_buffer[BUFFER_SIZE];
     char read_buffer[BUFFER_SIZE];
     ssize_t bytes_written, bytes_read;
+    int failed = 0;
     
     // Open device
     fd = open(DEVICE_PATH, O_RDWR);
@@ -46,9 +301,15 @@ int main() {
     read_buffer[bytes_read] = '\0';
     printf("Read %ld bytes from device: %s\n", bytes_read, read_buffer);
     
+    // Batched submission, appending after the message
+    failed |= test_batch_mixed(fd, bytes_written);
+    failed |= test_batch_zero_length(fd);
+    failed |= test_batch_bad_pointer(fd, bytes_written);
+    failed |= test_fifo(fd);
+    
     // Close device
     close(fd);
     printf("Device closed\n");
     
-    return EXIT_SUCCESS;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }